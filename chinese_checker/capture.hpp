@@ -0,0 +1,164 @@
+#ifndef CAPTURE_HPP
+#define CAPTURE_HPP
+
+#include <chrono>             // steady_clock, microseconds, milliseconds
+#include <condition_variable> // condition_variable
+#include <cstdint>            // uint32_t, uint64_t
+#include <cstdio>             // FILE, fopen, fread
+#include <cstring>            // memcmp
+#include <fcntl.h>            // open
+#include <iostream>           // cerr
+#include <mutex>              // mutex, unique_lock
+#include <string>             // string
+#include <thread>             // thread
+#include <unistd.h>           // write, close
+
+#include "common.hpp"
+#include "event_log.hpp"
+#include "lockable.hpp"
+
+constexpr char CAPTURE_MAGIC[8] = {'C', 'C', 'T', 'C', '0', '0', '0', '1'};
+
+// Frame received from a client as captured. An empty frame marks the end of
+// the session.
+struct captured_message {
+    // microseconds since the capture started
+    uint64_t time;
+    uint64_t session;
+    std::string frame;
+
+    // record length, time, session, frame as received
+    void encode(std::string& out) const {
+        room_event::put_number(out, 8 + 8 + frame.length(), 4);
+        room_event::put_number(out, time, 8);
+        room_event::put_number(out, session, 8);
+        out += frame;
+    }
+
+    // decode a record of length bytes following its length field
+    bool decode(const char* p, uint32_t length) {
+        if (length < 16) {
+            return false;
+        }
+        time = room_event::get_number(p, 8);
+        session = room_event::get_number(p + 8, 8);
+        frame.assign(p + 16, length - 16);
+        return true;
+    }
+};
+
+// Writes every frame clients send to a file. Sessions append the records of
+// a read at once under the lock, a thread of its own writes them out every
+// few milliseconds, so capturing costs the event loop a copy and no system
+// call. The capture is for benchmarks and is not synced to disk.
+class traffic_capture: public lockable {
+    public:
+        explicit traffic_capture(const std::string& path): start(std::chrono::steady_clock::now()), stopping(false) {
+            fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (fd < 0 || ::write(fd, CAPTURE_MAGIC, sizeof(CAPTURE_MAGIC)) != sizeof(CAPTURE_MAGIC)) {
+                std::cerr << "Failed to open the capture file " << path << "\n";
+            }
+            writer = std::thread([this]() {
+                    run();
+                    });
+        }
+
+        ~traffic_capture() {
+            {
+                std::lock_guard<std::mutex> lck(mtx);
+                stopping = true;
+            }
+            cv.notify_one();
+            writer.join();
+            if (fd >= 0) {
+                ::close(fd);
+            }
+        }
+
+        uint64_t now() const {
+            return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+        }
+
+        // queue encoded records, callable from any thread
+        void append(const std::string& records) {
+            ATOMIC_RUN(
+                    pending += records;
+                    )
+        }
+    private:
+        static constexpr int FLUSH_MILLISECONDS = 10;
+
+        void run() {
+            std::unique_lock<std::mutex> lck(mtx);
+            while (!stopping) {
+                cv.wait_for(lck, std::chrono::milliseconds(FLUSH_MILLISECONDS));
+                lck.unlock();
+                flush();
+                lck.lock();
+            }
+            lck.unlock();
+            flush();
+        }
+
+        void flush() {
+            lock();
+            writing.swap(pending);
+            unlock();
+            if (fd >= 0 && !writing.empty() && !event_log::write_all(fd, writing)) {
+                std::cerr << "Failed to write the capture file\n";
+            }
+            writing.clear();
+        }
+
+        const std::chrono::steady_clock::time_point start;
+        int fd;
+        std::string pending;
+        std::string writing;
+        std::mutex mtx;
+        std::condition_variable cv;
+        bool stopping;
+        std::thread writer;
+};
+
+constexpr int traffic_capture::FLUSH_MILLISECONDS;
+
+// Reads the messages of a capture file in order. A record cut short ends
+// the file.
+class capture_reader {
+    public:
+        capture_reader(): f(nullptr) {}
+
+        ~capture_reader() {
+            if (f) {
+                fclose(f);
+            }
+        }
+
+        // open a capture, false if missing or not a capture
+        bool open(const char* path) {
+            f = fopen(path, "rb");
+            char magic[sizeof(CAPTURE_MAGIC)];
+            return f && fread(magic, 1, sizeof(magic), f) == sizeof(magic) && memcmp(magic, CAPTURE_MAGIC, sizeof(magic)) == 0;
+        }
+
+        // false at the end of the file
+        bool next(captured_message& message) {
+            char header[4];
+            if (fread(header, 1, sizeof(header), f) != sizeof(header)) {
+                return false;
+            }
+            const uint32_t length = room_event::get_number(header, 4);
+            if (length > MAX_RECORD_LENGTH) {
+                return false;
+            }
+            record.resize(length);
+            return fread(&record[0], 1, length, f) == length && message.decode(record.data(), length);
+        }
+    private:
+        static constexpr uint32_t MAX_RECORD_LENGTH = 16 + MAX_FRAME_LENGTH + 1;
+
+        FILE* f;
+        std::string record;
+};
+
+#endif
@@ -2,860 +2,564 @@
 #include <chrono>    // milliseconds
 #include <cstdlib>   // system
 #include <cstring>   // memcpy
+#include <functional> // function
 #include <iostream>  // cout
-#include <memory>    // unique_ptr
+#include <memory>    // unique_ptr, shared_ptr
 #include <string>    // string
+#include <termios.h> // termios, tcsetattr, tcgetattr
+#include <thread>    // hardware_concurrency
+#include <unistd.h>  // dup, STDIN_FILENO
 #include <vector>    // vector
-#include <thread>    // this_thread
 
 #include "board.hpp"
 #include "common.hpp"
 #include "control_source.hpp"
 #include "direction.hpp"
-
-constexpr int M = 17;
-constexpr int N = 25;
-constexpr char CHAR_NONE = ' ';
-constexpr char CHAR_EMPTY = 'O';
-constexpr char CHAR_PLAYER[] = {'@', '*'};
-constexpr char INIT_BOARD[M * N + 1] =
-"            *            "
-"           * *           "
-"          * * *          "
-"         * * * *         "
-"O O O O O O O O O O O O O"
-" O O O O O O O O O O O O "
-"  O O O O O O O O O O O  "
-"   O O O O O O O O O O   "
-"    O O O O O O O O O    "
-"   O O O O O O O O O O   "
-"  O O O O O O O O O O O  "
-" O O O O O O O O O O O O "
-"O O O O O O O O O O O O O"
-"         @ @ @ @         "
-"          @ @ @          "
-"           @ @           "
-"            @            ";
-
-enum status_type {
-    PLAYER_WIN, PLAYER_CHANGE, CONTROL_CONT
-};
-
-class game_board: public board<char> {
+#include "game_board.hpp"
+#include "mcts.hpp"
+#include "position.hpp"
+#include "search.hpp"
+#include "tablebase.hpp"
+#include "transport.hpp"
+
+// Analysis line printed below the board. The analysis thread only sets the
+// text, the event loop thread prints it with the board, so the two never
+// write to the terminal at once.
+class analysis_line: public lockable {
     public:
-        game_board(bool need_swap, int my_player = 0): board(::M, ::N), need_swap(need_swap), my_player(my_player) {}
-
-        // next status of board
-        status_type next(char c) {
-            if (c == 'r') {
-                if (selected) {
-                    replay();
-                }
-            } else if (c == ' ') {
-                if (selected) {
-                    selected = false;
-                    if (!trace.empty()) {
-                        if (need_swap) {
-                            if (check_win_from_top()) {
-                                return PLAYER_WIN;
-                            }
-                        } else {
-                            if (my_player == current_player) {
-                                if (check_win_from_top()) {
-                                    return PLAYER_WIN;
-                                }
-                            } else {
-                                if (check_win_from_bottom()) {
-                                    return PLAYER_WIN;
-                                }
-                            }
-                        }
-                        current_player = (current_player + 1) % NUM_PLAYER;
-                        if (need_swap) {
-                            std::reverse(brd, brd + MN);
-                            find_from_bottom();
-                        } else {
-                            if (my_player == current_player) {
-                                find_from_bottom();
-                            } else {
-                                find_from_top();
-                            }
-                        }
-                        trace.clear();
-                        return PLAYER_CHANGE;
-                    }
-                } else {
-                    selected = true;
-                }
-            } else {
-                direction_6::Enum direct;
-                switch(c) {
-                    case 'a':
-                        [[fallthrough]];
-                    case 'h':
-                        direct = direction_6::LEFT;
-                        break;
-                    case 'w':
-                        [[fallthrough]];
-                    case 'u':
-                        direct = direction_6::LEFT_UP;
-                        break;
-                    case 'e':
-                        [[fallthrough]];
-                    case 'i':
-                        direct = direction_6::RIGHT_UP;
-                        break;
-                    case 'd':
-                        [[fallthrough]];
-                    case 'k':
-                        direct = direction_6::RIGHT;
-                        break;
-                    case 'x':
-                        [[fallthrough]];
-                    case 'm':
-                        direct = direction_6::RIGHT_DOWN;
-                        break;
-                    case 'z':
-                        [[fallthrough]];
-                    case 'n':
-                        direct = direction_6::LEFT_DOWN;
-                        break;
-                    default:
-                        return CONTROL_CONT;
-                }
-                if (selected) {
-                    if (trace.size() == 1 &&
-                            last_direction == direct &&
-                            move_type == SINGLE_STEP &&
-                            has_optional()) {
-                        move_type = HOP;
-                        move_to(optional_i, optional_j);
-                        no_optional();
-                    } else {
-                        int stored_optional_i = optional_i;
-                        int stored_optional_j = optional_j;
-                        if (move_selected(direct)) {
-                            last_direction = direct;
-                        } else {
-                            optional_i = stored_optional_i;
-                            optional_j = stored_optional_j;
-                        }
-                    }
-                } else {
-                    move_unselected(direct);
-                }
-            }
-            return CONTROL_CONT;
+        void set(const std::string& text) {
+            ATOMIC_RUN(
+                    line = text;
+                    )
         }
 
-        // reset board to initial status
-        void init() {
-            memcpy(brd, INIT_BOARD, M * N * sizeof(char));
-            current_player = 0;
-            if (my_player == 0) {
-                find_from_bottom();
+        // report of a completed depth
+        void set(int depth, int score, const std::vector<move>& pv) {
+            std::string text = "Analysis depth " + std::to_string(depth) + ": ";
+            if (is_win_score(score)) {
+                const int plies = SCORE_WIN - std::abs(score);
+                text += (score > 0 ? "finish in " : "opponent finishes in ") + std::to_string((plies + 1) / 2) + " moves";
+            } else if (is_tablebase_score(score)) {
+                // exact only while every piece stays within the table
+                const int plies = SCORE_TABLEBASE - std::abs(score);
+                text += (score > 0 ? "tablebase finish in about " : "tablebase: opponent finishes in about ") +
+                    std::to_string((plies + 1) / 2) + " moves";
             } else {
-                std::reverse(brd, brd + MN);
-                find_from_top();
+                text += "score " + std::string(score >= 0 ? "+" : "") + std::to_string(score);
             }
-            selected = false;
-            trace.clear();
-        }
-
-        // true if trace is empty
-        bool trace_empty() {
-            return trace.empty();
-        }
-
-        // current player
-        int get_current_player() {
-            return current_player;
+            for (int k = 0; k < (int)pv.size() && k < MAX_SHOWN_MOVES; k++) {
+                text += (k == 0 ? ", best " : " ") + position::name(pv[k].from) + "->" + position::name(pv[k].to);
+            }
+            set(text);
         }
 
-        // print board
+        // print without moving the cursor, on the event loop thread
         void print() {
-            system("clear");
-            for (int i = 0; i < M; i++) {
-                for (int j = 0; j < N; j++) {
-                    char& c = at(i, j);
-                    if (c == CHAR_NONE) {
-                        std::cout << " ";
-                    } else if (c == CHAR_EMPTY) {
-                        std::cout << "\e[37m\u2b24\e[0m";
-                    } else if (c == CHAR_PLAYER[0]) {
-                        if (i == current_i && j == current_j) {
-                            std::cout << "\e[91m\u2b24\e[0m";
-                        } else {
-                            std::cout << "\e[31m\u2b24\e[0m";
-                        }
-                    } else if (c == CHAR_PLAYER[1]) {
-                        if (i == current_i && j == current_j) {
-                            std::cout << "\e[92m\u2b24\e[0m";
-                        } else {
-                            std::cout << "\e[32m\u2b24\e[0m";
-                        }
-                    }
-                }
-                std::cout << std::endl;
-            }
+            ATOMIC_RUN(
+                    std::cout << "\e7\e[" << M + 2 << ";1H\e[K" << line << "\e8" << std::flush;
+                    )
         }
-
     private:
-        // set no optional location
-        inline void no_optional() { optional_i = -1; }
-
-        // return true if there is optional location
-        inline bool has_optional() { return optional_i >= 0; }
-
-        // replay moves
-        void replay() {
-            int stored_current_i = current_i;
-            int stored_current_j = current_j;
-            char char_player = CHAR_PLAYER[current_player];
-            at(current_i, current_j) = CHAR_EMPTY;
-            for (const std::pair<int, int>& p: trace) {
-                current_i = p.first;
-                current_j = p.second;
-                at(current_i, current_j) = char_player;
-                print();
-                std::cout << "Replaying...\n";
-                std::this_thread::sleep_for (std::chrono::milliseconds(500));
-                at(current_i, current_j) = CHAR_EMPTY;
-            }
-            current_i = stored_current_i;
-            current_j = stored_current_j;
-            at(current_i, current_j) = char_player;
-        }
-
-        // move current location to (i, j)
-        void move_to(int i, int j) {
-            std::swap(at(current_i, current_j), at(i, j));
-            current_i = i;
-            current_j = j;
-        }
-
-        // base template class to provide movement and check for different direction
-        template <direction_6::Enum Direction>
-            class iterator {
-                public:
-                    void set(int v1_i, int v1_j, int v2_i, int v2_j) {
-                        this->v1_i = v1_i;
-                        this->v1_j = v1_j;
-                        this->v2_i = v2_i;
-                        this->v2_j = v2_j;
-                    }
-
-                    int get_i() { return v1_i; }
-
-                    int get_j() { return v1_j; }
-
-                    template <direction_6::Enum _Direction = Direction, typename std::enable_if<_Direction == direction_6::LEFT, int>::type = 0>
-                        int get_init_end_i() { return 0; }
-
-                    template <direction_6::Enum _Direction = Direction, typename std::enable_if<_Direction == direction_6::LEFT, int>::type = 0>
-                        int get_init_end_j() { return 0; }
-
-                    template <direction_6::Enum _Direction = Direction, typename std::enable_if<_Direction == direction_6::LEFT, int>::type = 0>
-                        bool has_next() { return v1_j >= v2_j; }
-
-                    template <direction_6::Enum _Direction = Direction, typename std::enable_if<_Direction == direction_6::LEFT, int>::type = 0>
-                        void next() { v1_j -= 2; }
-
-                    template <direction_6::Enum _Direction = Direction, typename std::enable_if<_Direction == direction_6::LEFT, int>::type = 0>
-                        void get_target() { v1_j = v2_j - (v1_j - v2_j); }
-
-                    template <direction_6::Enum _Direction = Direction, typename std::enable_if<_Direction == direction_6::LEFT, int>::type = 0>
-                        bool target_out_of_bound() { return v1_j < 0; }
-
-                    template <direction_6::Enum _Direction = Direction, typename std::enable_if<_Direction == direction_6::RIGHT, int>::type = 0>
-                        int get_init_end_i() { return 0; }
-
-                    template <direction_6::Enum _Direction = Direction, typename std::enable_if<_Direction == direction_6::RIGHT, int>::type = 0>
-                        int get_init_end_j() { return ::N - 1; }
-
-                    template <direction_6::Enum _Direction = Direction, typename std::enable_if<_Direction == direction_6::RIGHT, int>::type = 0>
-                        bool has_next() { return v1_j <= v2_j; }
-
-                    template <direction_6::Enum _Direction = Direction, typename std::enable_if<_Direction == direction_6::RIGHT, int>::type = 0>
-                        void next() { v1_j += 2; }
-
-                    template <direction_6::Enum _Direction = Direction, typename std::enable_if<_Direction == direction_6::RIGHT, int>::type = 0>
-                        void get_target() { v1_j = v2_j + (v2_j - v1_j); }
-
-                    template <direction_6::Enum _Direction = Direction, typename std::enable_if<_Direction == direction_6::RIGHT, int>::type = 0>
-                        bool target_out_of_bound() { return v1_j >= ::N; }
-
-                    template <direction_6::Enum _Direction = Direction, typename std::enable_if<_Direction == direction_6::LEFT_UP, int>::type = 0>
-                        int get_init_end_i() { return 0; }
-
-                    template <direction_6::Enum _Direction = Direction, typename std::enable_if<_Direction == direction_6::LEFT_UP, int>::type = 0>
-                        int get_init_end_j() { return 0; }
-
-                    template <direction_6::Enum _Direction = Direction, typename std::enable_if<_Direction == direction_6::LEFT_UP, int>::type = 0>
-                        bool has_next() { return v1_i >= v2_i && v1_j >= v2_j; }
-
-                    template <direction_6::Enum _Direction = Direction, typename std::enable_if<_Direction == direction_6::LEFT_UP, int>::type = 0>
-                        void next() { v1_i--; v1_j--; }
-
-                    template <direction_6::Enum _Direction = Direction, typename std::enable_if<_Direction == direction_6::LEFT_UP, int>::type = 0>
-                        void get_target() { v1_i = v2_i - (v1_i - v2_i); v1_j = v2_j - (v1_j - v2_j); }
-
-                    template <direction_6::Enum _Direction = Direction, typename std::enable_if<_Direction == direction_6::LEFT_UP, int>::type = 0>
-                        bool target_out_of_bound() { return v1_i < 0 || v1_j < 0; }
-
-                    template <direction_6::Enum _Direction = Direction, typename std::enable_if<_Direction == direction_6::RIGHT_UP, int>::type = 0>
-                        int get_init_end_i() { return 0; }
-
-                    template <direction_6::Enum _Direction = Direction, typename std::enable_if<_Direction == direction_6::RIGHT_UP, int>::type = 0>
-                        int get_init_end_j() { return ::N - 1; }
-
-                    template <direction_6::Enum _Direction = Direction, typename std::enable_if<_Direction == direction_6::RIGHT_UP, int>::type = 0>
-                        bool has_next() { return v1_i >= v2_i && v1_j <= v2_j; }
+        static constexpr int MAX_SHOWN_MOVES = 4;
+        std::string line;
+};
 
-                    template <direction_6::Enum _Direction = Direction, typename std::enable_if<_Direction == direction_6::RIGHT_UP, int>::type = 0>
-                        void next() { v1_i--; v1_j++; }
 
-                    template <direction_6::Enum _Direction = Direction, typename std::enable_if<_Direction == direction_6::RIGHT_UP, int>::type = 0>
-                        void get_target() { v1_i = v2_i - (v1_i - v2_i); v1_j = v2_j + (v2_j - v1_j); }
+// Source of keys on the event loop. The next key is handed to a callback,
+// CHAR_EXCEPTION once the source is lost.
+class key_source {
+    public:
+        typedef std::function<void(char)> handler_type;
 
-                    template <direction_6::Enum _Direction = Direction, typename std::enable_if<_Direction == direction_6::RIGHT_UP, int>::type = 0>
-                        bool target_out_of_bound() { return v1_i < 0 || v1_j >= ::N; }
+        virtual void async_get(game_board& brd, handler_type handler) = 0;
+        virtual ~key_source() {}
+};
 
-                    template <direction_6::Enum _Direction = Direction, typename std::enable_if<_Direction == direction_6::LEFT_DOWN, int>::type = 0>
-                        int get_init_end_i() { return ::M - 1; }
+// keys typed on the terminal, each read as soon as it is pressed
+class keyboard_key_source: public key_source {
+    public:
+        keyboard_key_source(boost::asio::io_context& io_context): input(io_context, ::dup(STDIN_FILENO)) {
+            tcgetattr(STDIN_FILENO, &oldt);
+            struct termios newt = oldt;
+            newt.c_lflag &= ~(ICANON);
+            tcsetattr(STDIN_FILENO, TCSANOW, &newt);
+        }
 
-                    template <direction_6::Enum _Direction = Direction, typename std::enable_if<_Direction == direction_6::LEFT_DOWN, int>::type = 0>
-                        int get_init_end_j() { return 0; }
+        ~keyboard_key_source() {
+            tcsetattr(STDIN_FILENO, TCSANOW, &oldt);
+        }
 
-                    template <direction_6::Enum _Direction = Direction, typename std::enable_if<_Direction == direction_6::LEFT_DOWN, int>::type = 0>
-                        bool has_next() { return v1_i <= v2_i && v1_j >= v2_j; }
+        void async_get(game_board&, handler_type handler) {
+            boost::asio::async_read(input, boost::asio::buffer(&key, 1), [this, handler](boost::system::error_code ec, std::size_t) {
+                    handler(ec ? CHAR_EXCEPTION : key);
+                    });
+        }
+    private:
+        boost::asio::posix::stream_descriptor input;
+        struct termios oldt;
+        char key;
+};
 
-                    template <direction_6::Enum _Direction = Direction, typename std::enable_if<_Direction == direction_6::LEFT_DOWN, int>::type = 0>
-                        void next() { v1_i++; v1_j--; }
+// Computer opponent typing the moves of an engine. The engine thinks on a
+// thread of its own, the keys are typed on the event loop.
+class engine_key_source: public key_source {
+    public:
+        engine_key_source(boost::asio::io_context& io_context, engine* e): io_context(io_context), e(e), timer(io_context),
+            thinker(1), next_key(0) {}
 
-                    template <direction_6::Enum _Direction = Direction, typename std::enable_if<_Direction == direction_6::LEFT_DOWN, int>::type = 0>
-                        void get_target() { v1_i = v2_i + (v2_i - v1_i); v1_j = v2_j - (v1_j - v2_j); }
+        ~engine_key_source() {
+            thinker.join();
+        }
 
-                    template <direction_6::Enum _Direction = Direction, typename std::enable_if<_Direction == direction_6::LEFT_DOWN, int>::type = 0>
-                        bool target_out_of_bound() { return v1_i >= ::M || v1_j < 0; }
+        void async_get(game_board& brd, handler_type handler) {
+            if (!keys.empty()) {
+                type(handler);
+                return;
+            }
+            const position pos = brd.get_position();
+            game_board* b = &brd;
+            // the event loop has nothing else to wait for while the engine thinks
+            auto loop = boost::asio::require(io_context.get_executor(), boost::asio::execution::outstanding_work.tracked);
+            boost::asio::post(thinker, [this, pos, b, handler, loop]() {
+                    const move m = e->think(pos);
+                    boost::asio::post(loop, [this, m, b, handler]() {
+                            keys = plan(*b, m);
+                            next_key = 0;
+                            type(handler);
+                            });
+                    });
+        }
+    private:
+        // next key after a short delay, a move that cannot be typed ends the turn
+        void type(handler_type handler) {
+            constexpr int KEY_DELAY_MILLISECONDS = 150;
+            timer.expires_after(std::chrono::milliseconds(KEY_DELAY_MILLISECONDS));
+            timer.async_wait([this, handler](boost::system::error_code) {
+                    char c = ' ';
+                    if (!keys.empty()) {
+                        c = keys[next_key++];
+                        if (next_key == keys.size()) {
+                            keys.clear();
+                        }
+                    }
+                    handler(c);
+                    });
+        }
 
-                    template <direction_6::Enum _Direction = Direction, typename std::enable_if<_Direction == direction_6::RIGHT_DOWN, int>::type = 0>
-                        int get_init_end_i() { return ::M - 1; }
+        // keys of the engine move, or of the most advancing move the cursor can reach
+        static std::string plan(game_board& brd, const move& m) {
+            const position pos = brd.get_position();
+            std::string planned = brd.keys_for(m);
+            if (planned.empty()) {
+                move moves[MAX_MOVES];
+                int best_gain = -NUM_HOLE;
+                const int n = pos.generate(moves);
+                for (int k = 0; k < n; k++) {
+                    if (pos.gain(moves[k]) > best_gain) {
+                        std::string candidate = brd.keys_for(moves[k]);
+                        if (!candidate.empty()) {
+                            best_gain = pos.gain(moves[k]);
+                            planned = candidate;
+                        }
+                    }
+                }
+            }
+            return planned;
+        }
 
-                    template <direction_6::Enum _Direction = Direction, typename std::enable_if<_Direction == direction_6::RIGHT_DOWN, int>::type = 0>
-                        int get_init_end_j() { return ::N - 1; }
+        boost::asio::io_context& io_context;
+        engine* e;
+        boost::asio::steady_timer timer;
+        boost::asio::thread_pool thinker;
+        std::string keys;
+        size_t next_key;
+};
 
-                    template <direction_6::Enum _Direction = Direction, typename std::enable_if<_Direction == direction_6::RIGHT_DOWN, int>::type = 0>
-                        bool has_next() { return v1_i <= v2_i && v1_j <= v2_j; }
+// engine by name, nullptr if unknown
+engine* make_engine(const std::string& name, const tablebase* endgame) {
+    constexpr int THINK_MILLISECONDS = 2000;
+    const int threads = std::max(1, (int)std::thread::hardware_concurrency());
+    if (name == "mcts") {
+        return new mcts_engine(threads, THINK_MILLISECONDS);
+    } else if (name == "alphabeta") {
+        return new alpha_beta_engine(THINK_MILLISECONDS, endgame);
+    }
+    return nullptr;
+}
 
-                    template <direction_6::Enum _Direction = Direction, typename std::enable_if<_Direction == direction_6::RIGHT_DOWN, int>::type = 0>
-                        void next() { v1_i++; v1_j++; }
 
-                    template <direction_6::Enum _Direction = Direction, typename std::enable_if<_Direction == direction_6::RIGHT_DOWN, int>::type = 0>
-                        void get_target() { v1_i = v2_i + (v2_i - v1_i); v1_j = v2_j + (v2_j - v1_j); }
+// key of the remote source when the lobby seated the player again
+constexpr char CHAR_REMATCH = '\x1a';
 
-                    template <direction_6::Enum _Direction = Direction, typename std::enable_if<_Direction == direction_6::RIGHT_DOWN, int>::type = 0>
-                        bool target_out_of_bound() { return v1_i >= ::M || v1_j >= ::N; }
-                private:
-                    int v1_i;
-                    int v1_j;
-                    int v2_i;
-                    int v2_j;
-            };
+// Opponent on the server, over TCP or a Unix domain socket for a host
+// "unix:path". Login and matching wait for the reply before the game starts,
+// keys of the game are sent and received asynchronously.
+class remote_key_source: public key_source {
+    public:
+        remote_key_source(boost::asio::io_context& io_context, const char* host, const char* port): s(io_context), player(0),
+            writing(false) {
+            boost::asio::connect(s, resolve_stream(io_context, host, port));
+        }
 
-        // move one step towards direction
-        template <direction_6::Enum Direction>
-            bool move_by_one(int& current_i, int& current_j, int& planned_i, int& planned_j, iterator<Direction>& it) {
-                it.set(current_i, current_j, it.get_init_end_i(), it.get_init_end_j());
-                it.next();
-                if (it.has_next()) {
-                    planned_i = it.get_i();
-                    planned_j = it.get_j();
-                    return true;
-                }
+        bool login(const std::string& room_name, int player) {
+            const std::string request = (char)(player + 1) + room_name;
+            std::string frame;
+            append_frame(frame, commands::IN, request.data(), request.length());
+            if (boost::asio::write(s, boost::asio::buffer(frame)) != frame.length()) {
                 return false;
             }
+            return read_login_reply();
+        }
 
-        // try hop towards direction, return true if the plan is in board
-        template <direction_6::Enum Direction>
-            bool try_hop(int& planned_i, int& planned_j, bool& is_one_step) {
-                char char_in_board;
-                bool found = false;
-                bool blocked = false;
-                int target_i;
-                int target_j;
-                int bridge_i;
-                int bridge_j;
-                iterator<Direction> it;
-                it.set(current_i, current_j, it.get_init_end_i(), it.get_init_end_j());
-                while (it.next(), it.has_next()) {
-                    bridge_i = it.get_i();
-                    bridge_j = it.get_j();
-                    char_in_board = at(bridge_i, bridge_j);
-                    if (char_in_board == CHAR_NONE) {
-                        break;
-                    } else if (char_in_board != CHAR_EMPTY) {
-                        found = true;
-                        break;
-                    }
-                }
-                if (!found) {
-                    no_optional();
-                    is_one_step = true;
-                    return move_by_one<Direction>(current_i, current_j, planned_i, planned_j, it);
-                }
-
-                // assertion:
-                // (bridge_i, bridge_j) closer to edge of board than (current_i, current_j)
-                // (bridge_i, bridge_i) not at edge of board -> move_by_one returns true
-                it.set(current_i, current_j, bridge_i, bridge_j);
-                it.get_target();
-                target_i = it.get_i();
-                target_j = it.get_j();
-                if (it.target_out_of_bound() || at(target_i, target_j) == CHAR_NONE) {
-                    no_optional();
-                    is_one_step = true;
-                    return move_by_one<Direction>(current_i, current_j, planned_i, planned_j, it);
-                }
-
-                // assertion:
-                // (target_i, target_j) closer to edge of board than (bridge_i, bridge_j)
-                // (target_i, target_j) not out of board
-                it.set(bridge_i, bridge_j, target_i, target_j);
-                while (it.next(), it.has_next()) {
-                    planned_i = it.get_i();
-                    planned_j = it.get_j();
-                    if (at(planned_i, planned_j) != CHAR_EMPTY) {
-                        blocked = true;
-                        break;
-                    }
-                }
-                if (blocked) {
-                    no_optional();
-                    is_one_step = true;
-                    return move_by_one<Direction>(current_i, current_j, planned_i, planned_j, it);
-                }
-
-                // assertion:
-                // (bridge_i, bridge_j) to (target_i, target_j) not blocked
-                planned_i = target_i;
-                planned_j = target_j;
-                return move_by_one<Direction>(current_i, current_j, optional_i, optional_j, it);
-            }
-
-        // move when selected
-        bool move_selected(direction_6::Enum direct) {
-            int planned_i;
-            int planned_j;
-            bool is_one_step = false;
-            bool in_bound;
-            switch(direct) {
-                case direction_6::LEFT:
-                    in_bound = try_hop<direction_6::LEFT>(planned_i, planned_j, is_one_step);
-                    break;
-                case direction_6::RIGHT:
-                    in_bound = try_hop<direction_6::RIGHT>(planned_i, planned_j, is_one_step);
-                    break;
-                case direction_6::LEFT_UP:
-                    in_bound = try_hop<direction_6::LEFT_UP>(planned_i, planned_j, is_one_step);
-                    break;
-                case direction_6::RIGHT_UP:
-                    in_bound = try_hop<direction_6::RIGHT_UP>(planned_i, planned_j, is_one_step);
-                    break;
-                case direction_6::LEFT_DOWN:
-                    in_bound = try_hop<direction_6::LEFT_DOWN>(planned_i, planned_j, is_one_step);
-                    break;
-                case direction_6::RIGHT_DOWN:
-                    in_bound = try_hop<direction_6::RIGHT_DOWN>(planned_i, planned_j, is_one_step);
-                    break;
+        // ask the lobby for an opponent in a rating bucket, block until seated
+        bool match(int bucket, std::string& room_name, int& player) {
+            const char request = (char)bucket;
+            std::string frame;
+            append_frame(frame, commands::MATCH, &request, 1);
+            if (boost::asio::write(s, boost::asio::buffer(frame)) != frame.length()) {
+                return false;
             }
-            if (in_bound && (at(planned_i, planned_j) == CHAR_EMPTY)) {
-                if (trace.empty()) { // No move yet
-                    move_type = is_one_step ? SINGLE_STEP : HOP;
-                    if (move_type == HOP) {
-                        if (at(optional_i, optional_j) == CHAR_EMPTY) {
-                            std::swap(planned_i, optional_i);
-                            std::swap(planned_j, optional_j);
-                            move_type = SINGLE_STEP;
-                        } else {
-                            no_optional();
-                        }
-                    }
-                    trace.push_back(std::make_pair(current_i, current_j));
-                    move_to(planned_i, planned_j);
-                    return true;
-                } else if (move_type == SINGLE_STEP) {
-                    // If was single step, allow going back only
-                    const std::pair<int, int>& last_pos = trace.back();
-                    if (is_one_step) {
-                        if (last_pos.first == planned_i && last_pos.second == planned_j) {
-                            trace.pop_back();
-                            move_to(planned_i, planned_j);
-                            return true;
-                        }
-                    } else {
-                        if (last_pos.first == optional_i && last_pos.second == optional_j) {
-                            trace.pop_back();
-                            move_to(optional_i, optional_j);
-                            no_optional();
-                            return true;
-                        }
-                    }
-                } else if (!is_one_step) {
-                    if (!trim_trace_if_exists(planned_i, planned_j)) {
-                        trace.push_back(std::make_pair(current_i, current_j));
-                    }
-                    move_to(planned_i, planned_j);
-                    no_optional();
-                    return true;
-                }
+            char command;
+            std::string reply;
+            if (!read_frame(command, reply) || command != commands::MATCH || reply.length() < 2) {
+                return false;
             }
-            return false;
+            const bool ok = rematched(reply);
+            player = this->player;
+            room_name = this->room_name;
+            return ok;
         }
 
-        // move when not selected
-        void move_unselected(direction_6::Enum direct) {
-            int planned_i = current_i;
-            int planned_j = current_j;
-            char char_player = CHAR_PLAYER[current_player];
-            char char_in_board = CHAR_NONE;
-            bool found = false;
-            switch(direct) {
-                case direction_6::LEFT:
-                    for (planned_j -= 2; planned_j >= 0; planned_j -= 2) {
-                        char_in_board = at(planned_i, planned_j);
-                        if (char_in_board == char_player) {
-                            found = true;
-                            break;
-                        } else if (char_in_board == CHAR_NONE) {
-                            break;
-                        }
-                    }
-                    break;
-                case direction_6::RIGHT:
-                    for (planned_j += 2; planned_j < N; planned_j += 2) {
-                        char_in_board = at(planned_i, planned_j);
-                        if (char_in_board == char_player) {
-                            found = true;
-                            break;
-                        } else if (char_in_board == CHAR_NONE) {
-                            break;
-                        }
-                    }
-                    break;
-                case direction_6::LEFT_UP:
-                    for (planned_i--; planned_i >= 0; planned_i--) {
-                        for (planned_j -= ((current_i - planned_i) & 1); planned_j >= 0; planned_j -= 2) {
-                            char_in_board = at(planned_i, planned_j);
-                            if (char_in_board == char_player) {
-                                found = true;
-                                break;
-                            }
-                        }
-                        if (found) {
-                            break;
-                        }
-                        planned_j = current_j;
-                    }
-                    break;
-                case direction_6::RIGHT_UP:
-                    for (planned_i--; planned_i >= 0; planned_i--) {
-                        for (planned_j += ((current_i - planned_i) & 1); planned_j < N; planned_j += 2) {
-                            char_in_board = at(planned_i, planned_j);
-                            if (char_in_board == char_player) {
-                                found = true;
-                                break;
-                            }
-                        }
-                        if (found) {
-                            break;
-                        }
-                        planned_j = current_j;
-                    }
-                    break;
-                case direction_6::LEFT_DOWN:
-                    for (planned_i++; planned_i < M; planned_i++) {
-                        for (planned_j -= ((planned_i - current_i) & 1); planned_j >= 0; planned_j -= 2) {
-                            char_in_board = at(planned_i, planned_j);
-                            if (char_in_board == char_player) {
-                                found = true;
-                                break;
-                            }
-                        }
-                        if (found) {
-                            break;
-                        }
-                        planned_j = current_j;
-                    }
-                    break;
-                case direction_6::RIGHT_DOWN:
-                    for (planned_i++; planned_i < M; planned_i++) {
-                        for (planned_j += ((planned_i - current_i) & 1); planned_j < N; planned_j += 2) {
-                            char_in_board = at(planned_i, planned_j);
-                            if (char_in_board == char_player) {
-                                found = true;
-                                break;
-                            }
-                        }
-                        if (found) {
-                            break;
-                        }
-                        planned_j = current_j;
-                    }
-                    break;
-            }
-            if (found) {
-                current_i = planned_i;
-                current_j = planned_j;
+        // bring brd to the game received at login
+        void resync(game_board& brd) {
+            brd.restore(snapshot.holes, snapshot.current_player);
+            for (char c: turn_keys) {
+                brd.next(c);
             }
         }
 
-        // check if wins from top
-        bool check_win_from_top() {
-            char c = CHAR_PLAYER[current_player];
-            for (int i = 0; i < 4; i++) {
-                const int max_j = 12 + i;
-                for (int j = 12 - i; j <= max_j; j += 2) {
-                    if (at(i, j) != c) {
-                        return false;
-                    }
-                }
-            }
-            return true;
+        // seat given by the last MATCH
+        int get_player() const {
+            return player;
         }
 
-        // check if wins from bottom
-        bool check_win_from_bottom() {
-            char c = CHAR_PLAYER[current_player];
-            for (int i = M - 4; i < M; i++) {
-                const int max_j = 12 + (M - i - 1);
-                for (int j = 12 - (M - i - 1); j <= max_j; j += 2) {
-                    if (at(i, j) != c) {
-                        return false;
-                    }
+        const std::string& get_room() const {
+            return room_name;
+        }
+
+        // next key of the opponent, or of either player for spectators.
+        // CHAR_REMATCH when the matched opponent never came and the lobby seated the player again.
+        void async_get(game_board& brd, handler_type handler) {
+            char command;
+            const char* payload;
+            size_t length;
+            if (reader.next(command, payload, length)) {
+                char c = command == commands::PUT && length == 1 ? payload[0] : CHAR_EXCEPTION;
+                if (command == commands::MATCH && length >= 2) {
+                    const std::string reply(payload, length);
+                    c = rematched(reply) ? CHAR_REMATCH : CHAR_EXCEPTION;
                 }
+                // keys already read are handed over from the event loop, never from within this call
+                boost::asio::post(s.get_executor(), [handler, c]() {
+                        handler(c);
+                        });
+                return;
             }
-            return true;
+            if (reader.is_malformed()) {
+                boost::asio::post(s.get_executor(), [handler]() {
+                        handler(CHAR_EXCEPTION);
+                        });
+                return;
+            }
+            game_board* b = &brd;
+            s.async_read_some(boost::asio::buffer(in), [this, b, handler](boost::system::error_code ec, std::size_t length) {
+                    if (ec) {
+                        handler(CHAR_EXCEPTION);
+                        return;
+                    }
+                    reader.feed(in, length);
+                    async_get(*b, handler);
+                    });
         }
 
-        // trim trace if plan exists, return true if plan exists
-        bool trim_trace_if_exists(int planned_i, int planned_j) {
-            for (int i = 0; i < trace.size(); i++) {
-                if (trace[i].first == planned_i && trace[i].second == planned_j) {
-                    while (trace.back().first != planned_i && trace.back().second != planned_j) {
-                        trace.pop_back();
-                    }
-                    trace.pop_back();
-                    return true;
-                }
+        // queue a key of the local player, keys typed during a write follow in the next one
+        void send(char c) {
+            append_frame(outbox, commands::PUT, &c, 1);
+            flush();
+        }
+    private:
+        // seat of a MATCH reply, then the login to it
+        bool rematched(const std::string& reply) {
+            player = (int)reply[0] - 1;
+            room_name = reply.substr(1);
+            return read_login_reply();
+        }
+
+        void flush() {
+            if (writing || outbox.empty()) {
+                return;
             }
-            return false;
+            writing = true;
+            out.swap(outbox);
+            outbox.clear();
+            boost::asio::async_write(s, boost::asio::buffer(out), [this](boost::system::error_code ec, std::size_t) {
+                    writing = false;
+                    if (!ec) {
+                        flush();
+                    }
+                    });
         }
 
-        // find from top
-        void find_from_top() {
-            char char_player = CHAR_PLAYER[current_player];
-            for (int i = 0; i < MN; i++) {
-                if (brd[i] == char_player) {
-                    current_i = i / N;
-                    current_j = i % N;
-                    break;
+        // reply to a login, false unless seated
+        bool read_login_reply() {
+            char command;
+            std::string reply;
+            if (!read_frame(command, reply) || command != success_fail::SUCCESS) {
+                return false;
+            }
+            // the game as the room has it, followed by the keys played this turn
+            if (!read_frame(command, reply) || command != commands::SNAPSHOT || !snapshot.decode(reply.data(), reply.length())) {
+                return false;
+            }
+            turn_keys.clear();
+            for (int k = 0; k < snapshot.turn_keys; k++) {
+                if (!read_frame(command, reply) || command != commands::PUT || reply.length() != 1) {
+                    return false;
                 }
+                turn_keys += reply[0];
             }
+            return true;
         }
 
-        // find from bottom
-        void find_from_bottom() {
-            char char_player = CHAR_PLAYER[current_player];
-            for (int i = MN - 1; i > 0; i--) {
-                if (brd[i] == char_player) {
-                    current_i = i / N;
-                    current_j = i % N;
-                    break;
+        // read until a whole frame arrived, frames after it stay buffered
+        bool read_frame(char& command, std::string& payload) {
+            const char* data;
+            size_t length;
+            while (!reader.next(command, data, length)) {
+                if (reader.is_malformed()) {
+                    return false;
                 }
+                reader.feed(in, s.read_some(boost::asio::buffer(in)));
             }
+            payload.assign(data, length);
+            return true;
         }
 
-        // Current move type
-        enum {
-            HOP, SINGLE_STEP
-        } move_type;
-
-        // current location is selected
-        bool selected;
+        stream_socket s;
+        char in[256];
+        frame_reader reader;
+        int player;
+        std::string room_name;
+        snapshot_message snapshot;
+        std::string turn_keys;
+        bool writing;
+        std::string outbox;
+        std::string out;
+};
 
-        // current player
-        int current_player;
+// restart background analysis on the position at the start of a turn
+void ponder(analyzer* analysis, analysis_line& line, game_board& brd) {
+    if (analysis) {
+        line.set("Analysing...");
+        analysis->analyze(brd.get_position());
+    }
+}
 
-        // current location
-        int current_i;
-        int current_j;
+// print board with analysis line
+void show(analyzer* analysis, analysis_line& line, game_board& brd) {
+    brd.print();
+    if (analysis) {
+        line.print();
+    }
+}
 
-        // optional location, exists in HOP move
-        int optional_i;
-        int optional_j;
+// stop background analysis when game ends
+void stop_pondering(analyzer* analysis, analysis_line& line) {
+    if (analysis) {
+        analysis->stop();
+        line.set("");
+    }
+}
 
-        // last direction, used for HOP move
-        direction_6::Enum last_direction;
 
-        // previous location in order, used for replay
-        std::vector<std::pair<int, int> > trace;
+// Everything a game on the event loop works on, shared by the copies of its
+// flow that wait in handlers.
+struct game_state {
+    game_state(bool solo, int player): brd(solo, player == SPECTATOR ? 0 : player), keyboard(nullptr), remote(nullptr),
+        waiting(nullptr), player(player), solo(solo), resynced(false), analysis(nullptr), line(nullptr) {}
 
-        // true if need swap
-        const bool need_swap;
+    // seat the local player as p against the remote one
+    void seat(int p) {
+        player = p;
+        brd.set_player(p);
+        sources[p] = keyboard;
+        sources[1 - p] = remote;
+    }
 
-        // player of board
-        const int my_player;
+    game_board brd;
+    // source of the keys of each player
+    key_source* sources[2];
+    key_source* keyboard;
+    remote_key_source* remote;
+    key_source* waiting;
+    int player;
+    bool solo;
+    bool resynced;
+    status_type status;
+    analyzer* analysis;
+    analysis_line* line;
 };
 
-struct login_info {
-    std::string* room_name;
-    int* player;
-};
+#include <boost/asio/yield.hpp>
 
-class cc_remote_control_source: public virtual remote_control_source<char> {
+// Game played as a stackless coroutine: each key is awaited from the source
+// of the player in turn and the flow resumes in its handler, so keyboard,
+// network and engine all run on the one event loop thread.
+class game_flow: boost::asio::coroutine {
     public:
-        cc_remote_control_source(const char* host, const char* port): remote_control_source<char>(host, port){}
-
-        char get(board<char>* brd) {
-            constexpr int LENGTH = 1;
-            char write_buffer[] = {commands::GET};
-            char read_buffer[LENGTH];
-            std::this_thread::sleep_for(std::chrono::milliseconds(200));
-            size_t write_length = boost::asio::write(s, boost::asio::buffer(write_buffer, LENGTH));
-            if (write_length == 0) {
-                return CHAR_EXIT;
-            }
-            size_t read_length = boost::asio::read(s, boost::asio::buffer(read_buffer, LENGTH));
-            if (read_length == 0) {
-                return CHAR_EXIT;
-            }
-            if (read_buffer[0] == ' ') {
-                if (!dynamic_cast<game_board*>(brd)->trace_empty()) {
-                    return CHAR_EXIT;
+        explicit game_flow(std::shared_ptr<game_state> state): state(state) {}
+
+        void operator()(char key = 0) {
+            game_state& g = *state;
+            reenter (this) {
+                for (;;) {
+                    g.brd.init();
+                    if (g.remote && !g.resynced) {
+                        // join the game where the room left it
+                        g.remote->resync(g.brd);
+                        g.resynced = true;
+                    }
+                    ponder(g.analysis, *g.line, g.brd);
+                    do {
+                        show(g.analysis, *g.line, g.brd);
+                        g.waiting = g.sources[g.brd.get_current_player()];
+                        yield g.waiting->async_get(g.brd, *this);
+                        if (key == CHAR_EXCEPTION) {
+                            if (g.waiting == g.remote) {
+                                std::cerr << "Connection lost.\n";
+                            }
+                            return;
+                        }
+                        if (key == CHAR_REMATCH) {
+                            // start over in the new room
+                            g.seat(g.remote->get_player());
+                            g.resynced = false;
+                            std::cout << "Opponent left, playing as player " << g.player << " in room " << g.remote->get_room()
+                                << std::endl;
+                            break;
+                        }
+                        if (g.remote && g.brd.get_current_player() == g.player) {
+                            g.remote->send(key);
+                        }
+                        if ((g.status = g.brd.next(key)) == PLAYER_CHANGE) {
+                            ponder(g.analysis, *g.line, g.brd);
+                        }
+                    } while (g.status != PLAYER_WIN);
+                    if (g.remote && !g.resynced) {
+                        continue;
+                    }
+                    stop_pondering(g.analysis, *g.line);
+                    if (g.player == SPECTATOR) {
+                        // follow the next game of the room
+                        continue;
+                    }
+                    if (g.solo || g.player == g.brd.get_current_player()) {
+                        std::cout << "You win! Press any key for another game." << std::endl;
+                    } else {
+                        std::cout << "You lose! Press any key for another game." << std::endl;
+                    }
+                    yield g.keyboard->async_get(g.brd, *this);
+                    if (key == CHAR_EXCEPTION) {
+                        return;
+                    }
                 }
             }
-            return read_buffer[0];
-        }
-
-        bool send(char c) {
-            constexpr int LENGTH = 2;
-            char write_buffer[] = {commands::PUT, c};
-            return boost::asio::write(s, boost::asio::buffer(write_buffer, LENGTH)) == LENGTH;
-        }
-
-        bool login(void* payload) {
-            login_info* info = (login_info*)payload;
-            int player = *(info->player) + 1;
-            std::string* room_name = info->room_name;
-            char write_buffer[] = {commands::IN, (char)player, '\0'};
-            std::string to_write = write_buffer + *room_name;
-            char read_buffer[1];
-            size_t write_length = boost::asio::write(s, boost::asio::buffer(to_write, to_write.length()));
-            if (write_length == 0) {
-                return false;
-            }
-            size_t read_length = boost::asio::read(s, boost::asio::buffer(read_buffer, 1));
-            if (read_length == 0) {
-                return false;
-            }
-            return read_buffer[0] == success_fail::SUCCESS;
-        }
-
-        void logout() {
-            constexpr int LENGTH = 1;
-            char write_buffer[] = {commands::OUT};
-            boost::asio::write(s, boost::asio::buffer(write_buffer, LENGTH)) == LENGTH;
         }
+    private:
+        std::shared_ptr<game_state> state;
 };
 
+#include <boost/asio/unyield.hpp>
+
 int main(int argc, char** argv) {
-    bool client_mode;
-    if (argc == 1) {
-        client_mode = false;
-    } else if (argc == 5) {
-        client_mode = true;
-    } else {
-        std::cerr << "Usage: " << argv[0] << " <host> <port> <room> <player>\n";
+    bool analysis_mode = argc > 1 && std::string(argv[argc - 1]) == "-a";
+    if (analysis_mode) {
+        argc--;
+    }
+    if (argc != 1 && argc != 2 && argc != 5) {
+        std::cerr << "Usage: " << argv[0] << " [<host> <port> <room> <player|s> | <host> <port> -m <rating bucket> | mcts | alphabeta]"
+            " [-a]\n" "A host unix:<path> connects over the server's Unix domain socket, the port is not used.\n";
         return 1;
     }
-    if (client_mode) {
-        char c;
-        int player = atoi(argv[4]);
+    tablebase endgame;
+    const tablebase* tb = endgame.open(TABLEBASE_PATH) ? &endgame : nullptr;
+    boost::asio::io_context io_context;
+    analysis_line line;
+    // stopped before io_context goes, so no redraw is posted after
+    std::unique_ptr<analyzer> analysis;
+    if (analysis_mode) {
+        analysis.reset(new analyzer([&line, &io_context](int depth, int score, const std::vector<move>& pv) {
+                    line.set(depth, score, pv);
+                    boost::asio::post(io_context, [&line]() {
+                            line.print();
+                            });
+                    }, tb));
+    }
+    int player = 0;
+    std::unique_ptr<engine> opponent;
+    std::unique_ptr<engine_key_source> computer;
+    std::unique_ptr<remote_key_source> remote;
+    if (argc == 2) {
+        opponent.reset(make_engine(argv[1], tb));
+        if (!opponent) {
+            std::cerr << "Unknown engine \"" << argv[1] << "\", use mcts or alphabeta.\n";
+            return 1;
+        }
+        computer.reset(new engine_key_source(io_context, opponent.get()));
+    } else if (argc == 5 && std::string(argv[3]) == "-m") {
+        remote.reset(new remote_key_source(io_context, argv[1], argv[2]));
+        std::string room_name;
+        std::cout << "Waiting for an opponent..." << std::endl;
+        if (!remote->match(atoi(argv[4]), room_name, player)) {
+            std::cerr << "Matching failed! Server busy.\n";
+            return 1;
+        }
+        std::cout << "Playing as player " << player << " in room " << room_name << std::endl;
+    } else if (argc == 5) {
+        player = std::string(argv[4]) == "s" ? SPECTATOR : atoi(argv[4]);
         std::string room_name(argv[3]);
         if (room_name.length() > MAX_ROOM_NAME_LENGTH) {
             std::cerr << "Room name \"" << room_name << "\" too long.\n"
                 << "Please limit to " << MAX_ROOM_NAME_LENGTH << " characters.\n";
             return 1;
         }
-        game_board brd(false, player);
-        std::unique_ptr<control_source<char> > source1(new unix_keyboard_control_source<char>());
-        std::unique_ptr<control_source<char> > source2(new cc_remote_control_source(argv[1], argv[2]));
-        login_info info{ &room_name, &player };
-        if (!dynamic_cast<remote_control_source<char>*>(source2.get())->login(&info)) {
+        remote.reset(new remote_key_source(io_context, argv[1], argv[2]));
+        if (!remote->login(room_name, player)) {
             std::cerr << "Login failed! Room/player occupied.\n";
             return 1;
         }
-        control_source_runner<char, false> runner1(source1.get(), &brd);
-        control_source_runner<char, false> runner2(source2.get(), &brd);
-        runner1.run();
-        blocking_queue<false>& q1 = (player == 0 ? runner1 : runner2);
-        blocking_queue<false>& q2 = (player == 0 ? runner2 : runner1);
-        status_type status;
-        do {
-            brd.init();
-            q1.clear();
-            q2.clear();
-            do {
-                if (player == 1) {
-                    runner2.run();
-                }
-                do {
-                    brd.print();
-                    c = q1.get();
-                    if (player == 0) {
-                        dynamic_cast<remote_control_source<char>*>(source2.get())->send(c);
-                    }
-                    status = brd.next(c);
-                } while (status == CONTROL_CONT);
-                if (status == PLAYER_CHANGE) {
-                    if (player == 0) {
-                        runner2.run();
-                    }
-                    do {
-                        brd.print();
-                        c = q2.get();
-                        if (player == 1) {
-                            dynamic_cast<remote_control_source<char>*>(source2.get())->send(c);
-                        }
-                        status = brd.next(c);
-                    } while (status == CONTROL_CONT);
-                }
-            } while (status != PLAYER_WIN);
-            if (player == brd.get_current_player()) {
-                std::cout << "You win! Press any key for another game." << std::endl;
-            } else {
-                std::cout << "You lose! Press any key for another game." << std::endl;
-            }
-            runner1.get();
-        } while(1);
+    }
+    std::shared_ptr<game_state> state = std::make_shared<game_state>(argc == 1, player);
+    std::unique_ptr<keyboard_key_source> keyboard;
+    if (player != SPECTATOR) {
+        keyboard.reset(new keyboard_key_source(io_context));
+    }
+    state->keyboard = keyboard.get();
+    state->remote = remote.get();
+    state->analysis = analysis.get();
+    state->line = &line;
+    if (player == SPECTATOR) {
+        // follow both players, keys arrive in the view of player 0
+        state->sources[0] = state->sources[1] = remote.get();
+    } else if (argc == 1) {
+        state->sources[0] = state->sources[1] = keyboard.get();
     } else {
-        game_board brd(true);
-        std::unique_ptr<control_source<char> > source(new unix_keyboard_control_source<char>());
-        control_source_runner<char, false> runner(source.get(), &brd);
-        runner.run();
-        blocking_queue<false>& q = runner;
-        status_type status;
-        do {
-            brd.init();
-            q.clear();
-            do {
-                brd.print();
-            } while ((status = brd.next(q.get())) != PLAYER_WIN);
-            std::cout << "You win! Press any key for another game." << std::endl;
-            q.get();
-        } while(1);
+        key_source* other = remote ? (key_source*)remote.get() : computer.get();
+        state->sources[player] = keyboard.get();
+        state->sources[1 - player] = other;
     }
-
-    return 0;
+    game_flow flow(state);
+    flow();
+    io_context.run();
+    return 1;
 }
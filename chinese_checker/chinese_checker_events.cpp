@@ -0,0 +1,28 @@
+#include <iostream> // cout, cerr
+
+#include "event_log.hpp"
+
+// Print the room events of event log segments in order, one per line: time
+// in microseconds, room, player, event, room sequence and keys.
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        std::cerr << "Usage: " << argv[0] << " <segment>...\n";
+        return 1;
+    }
+    for (int a = 1; a < argc; a++) {
+        event_reader reader;
+        if (!reader.open(argv[a])) {
+            std::cerr << "Not an event log segment: " << argv[a] << "\n";
+            return 1;
+        }
+        room_event event;
+        while (reader.next(event)) {
+            std::cout << event.time << " " << event.room << " " << event.player << " " << event.type << " " << event.sequence;
+            if (!event.keys.empty()) {
+                std::cout << " " << event.keys;
+            }
+            std::cout << "\n";
+        }
+    }
+    return 0;
+}
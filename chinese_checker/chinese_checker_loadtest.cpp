@@ -0,0 +1,733 @@
+#include <algorithm> // max, sort
+#include <atomic>    // atomic
+#include <chrono>    // steady_clock, seconds, microseconds, nanoseconds
+#include <cstdint>   // uint32_t, uint64_t
+#include <cstdlib>   // atoi, atoll
+#include <deque>     // deque
+#include <iostream>  // cout, cerr
+#include <memory>    // shared_ptr, make_shared
+#include <mutex>     // mutex, lock_guard
+#include <poll.h>    // poll
+#include <string>    // string, to_string
+#include <thread>    // thread, this_thread
+#include <unistd.h>  // getopt
+#include <vector>    // vector
+
+#include <boost/asio.hpp>
+
+#include "cluster.hpp"
+#include "common.hpp"
+#include "game_board.hpp"
+#include "transport.hpp"
+
+using boost::asio::ip::tcp;
+
+// Load generator for chinese_checker_server. Clients log into rooms in
+// pairs. In every room player 0 drives: it sends keys, either keeping a
+// window of keys in flight or at a fixed rate, and player 1 answers each key
+// it receives with a key of its own. Both play whole games: the player to
+// move types a forward move, the other one sends replay keys, which rooms
+// relay without playing. The driver times every key until the answer
+// arrives, keys are answered in order so a FIFO of send times gives the
+// round trip. Spectators log into every room and count the keys they watch.
+// Measurement starts once every client has logged in. With -m clients ask
+// the lobby for matches instead, see seeker. -x checks a server of that many
+// workers routes each login, see check_workers.
+
+std::atomic<uint64_t> round_trips(0);
+std::atomic<uint64_t> watched_keys(0);
+std::atomic<uint64_t> failures(0);
+std::atomic<uint64_t> matches(0);
+std::atomic<int> logged_in_count(0);
+std::atomic<bool> measuring(false);
+
+// longest wait for every client to be answered at login
+constexpr int LOGIN_SECONDS = 30;
+
+std::mutex samples_mtx;
+std::vector<uint32_t> all_samples;
+
+struct options {
+    int window = 1;
+    int rate = 0;
+    std::string script;
+};
+
+class player: public std::enable_shared_from_this<player> {
+    public:
+        player(boost::asio::io_context& io_context, const std::string& room_name, int index, const options& opts, uint64_t seed):
+            socket_(boost::asio::make_strand(io_context)), timer(socket_.get_executor()), room_name(room_name),
+            index(index), opts(opts), rng(seed), script_position(0), logged_in(false), writing(false),
+            brd(false, index == SPECTATOR ? 0 : index) {
+            brd.init();
+        }
+
+        void start(const std::vector<stream_endpoint>& endpoints) {
+            auto self(shared_from_this());
+            boost::asio::async_connect(socket_, endpoints,
+                [this, self](boost::system::error_code ec, const stream_endpoint&) {
+                    if (ec) {
+                        failures++;
+                        return;
+                    }
+                    set_no_delay(socket_);
+                    const std::string request = (char)(index + 1) + room_name;
+                    append_frame(outbox, commands::IN, request.data(), request.length());
+                    flush();
+                    do_read();
+                });
+        }
+
+        // driver starts sending once every client is in
+        void drive() {
+            auto self(shared_from_this());
+            boost::asio::post(socket_.get_executor(), [this, self]() {
+                    if (opts.rate > 0) {
+                        next_send = std::chrono::steady_clock::now();
+                        tick();
+                    } else {
+                        for (int k = 0; k < opts.window; k++) {
+                            put();
+                        }
+                        flush();
+                    }
+                    });
+        }
+
+        void stop() {
+            auto self(shared_from_this());
+            boost::asio::post(socket_.get_executor(), [this, self]() {
+                    boost::system::error_code ec;
+                    timer.cancel(ec);
+                    socket_.close(ec);
+                    std::lock_guard<std::mutex> lck(samples_mtx);
+                    all_samples.insert(all_samples.end(), samples.begin(), samples.end());
+                    });
+        }
+    private:
+        void do_read() {
+            auto self(shared_from_this());
+            socket_.async_read_some(boost::asio::buffer(in),
+                [this, self](boost::system::error_code ec, std::size_t length) {
+                    if (ec) {
+                        if (!logged_in) {
+                            // closed before answering the login
+                            failures++;
+                        }
+                        return;
+                    }
+                    reader.feed(in, length);
+                    char command;
+                    const char* payload;
+                    size_t payload_length;
+                    while (reader.next(command, payload, payload_length)) {
+                        if (!logged_in) {
+                            if (command != success_fail::SUCCESS) {
+                                failures++;
+                                return;
+                            }
+                            logged_in = true;
+                            logged_in_count++;
+                        } else if (command != commands::PUT || payload_length != 1) {
+                            continue;
+                        } else if (index == SPECTATOR) {
+                            if (measuring.load(std::memory_order_relaxed)) {
+                                watched_keys.fetch_add(1, std::memory_order_relaxed);
+                            }
+                        } else {
+                            play(payload[0]);
+                            if (index == 1) {
+                                put();
+                            } else if (!sent.empty()) {
+                                const uint32_t microseconds = std::chrono::duration_cast<std::chrono::microseconds>(
+                                        std::chrono::steady_clock::now() - sent.front()).count();
+                                sent.pop_front();
+                                if (measuring.load(std::memory_order_relaxed)) {
+                                    samples.push_back(microseconds);
+                                    round_trips.fetch_add(1, std::memory_order_relaxed);
+                                }
+                                if (opts.rate == 0) {
+                                    put();
+                                }
+                            }
+                        }
+                    }
+                    flush();
+                    do_read();
+                });
+        }
+
+        // send due keys at the configured rate
+        void tick() {
+            auto self(shared_from_this());
+            const std::chrono::steady_clock::duration interval = std::chrono::nanoseconds(1000000000LL / opts.rate);
+            const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+            while (next_send <= now) {
+                put();
+                next_send += interval;
+            }
+            flush();
+            timer.expires_at(next_send);
+            timer.async_wait([this, self](boost::system::error_code ec) {
+                    // the wait may have completed just before stop
+                    if (!ec && socket_.is_open()) {
+                        tick();
+                    }
+                    });
+        }
+
+        void put() {
+            char key;
+            if (!opts.script.empty()) {
+                key = opts.script[script_position++ % opts.script.length()];
+            } else if (brd.get_current_player() != index) {
+                key = 'r';
+            } else {
+                if (planned.empty()) {
+                    planned = plan();
+                }
+                key = planned.empty() ? 'r' : planned[0];
+                planned.erase(0, 1);
+                play(key);
+            }
+            append_frame(outbox, commands::PUT, &key, 1);
+            if (index == 0) {
+                sent.push_back(std::chrono::steady_clock::now());
+            }
+        }
+
+        // keys of the most advancing move the cursor can reach, ties broken at random
+        std::string plan() {
+            const position pos = brd.get_position();
+            move moves[MAX_MOVES];
+            const int n = pos.generate(moves);
+            std::string best;
+            int best_gain = -NUM_HOLE;
+            rng ^= rng << 13;
+            rng ^= rng >> 7;
+            rng ^= rng << 17;
+            for (int k = 0; k < n; k++) {
+                const move& m = moves[(k + rng) % n];
+                if (pos.gain(m) > best_gain) {
+                    std::string keys = brd.keys_for(m);
+                    if (!keys.empty()) {
+                        best_gain = pos.gain(m);
+                        best = keys;
+                    }
+                }
+            }
+            return best;
+        }
+
+        // follow the game, replay keys change nothing
+        void play(char key) {
+            if (opts.script.empty() && key != 'r' && brd.next(key) == PLAYER_WIN) {
+                brd.init();
+                planned.clear();
+            }
+        }
+
+        // write queued frames in one write
+        void flush() {
+            if (writing || outbox.empty()) {
+                return;
+            }
+            auto self(shared_from_this());
+            writing = true;
+            out.swap(outbox);
+            outbox.clear();
+            boost::asio::async_write(socket_, boost::asio::buffer(out),
+                [this, self](boost::system::error_code ec, std::size_t) {
+                    writing = false;
+                    if (!ec) {
+                        flush();
+                    }
+                });
+        }
+
+        stream_socket socket_;
+        boost::asio::steady_timer timer;
+        std::string room_name;
+        int index;
+        const options& opts;
+        uint64_t rng;
+        size_t script_position;
+        bool logged_in;
+        bool writing;
+        std::string outbox;
+        std::string out;
+        char in[4096];
+        frame_reader reader;
+        std::deque<std::chrono::steady_clock::time_point> sent;
+        std::chrono::steady_clock::time_point next_send;
+        std::vector<uint32_t> samples;
+        game_board brd;
+        std::string planned;
+};
+
+// Client of the lobby: asks for a match in a random rating bucket, leaves the
+// room as soon as it is seated and asks again. Every request is timed until
+// the match.
+class seeker: public std::enable_shared_from_this<seeker> {
+    public:
+        seeker(boost::asio::io_context& io_context, int buckets, uint64_t seed):
+            socket_(boost::asio::make_strand(io_context)), timer(socket_.get_executor()), buckets(buckets), rng(seed),
+            writing(false) {}
+
+        void start(const std::vector<stream_endpoint>& endpoints) {
+            auto self(shared_from_this());
+            boost::asio::async_connect(socket_, endpoints,
+                [this, self](boost::system::error_code ec, const stream_endpoint&) {
+                    if (ec) {
+                        failures++;
+                        return;
+                    }
+                    set_no_delay(socket_);
+                    seek();
+                    flush();
+                    do_read();
+                });
+        }
+
+        void stop() {
+            auto self(shared_from_this());
+            boost::asio::post(socket_.get_executor(), [this, self]() {
+                    boost::system::error_code ec;
+                    timer.cancel(ec);
+                    socket_.close(ec);
+                    std::lock_guard<std::mutex> lck(samples_mtx);
+                    all_samples.insert(all_samples.end(), samples.begin(), samples.end());
+                    });
+        }
+    private:
+        static constexpr int RETRY_MILLISECONDS = 100;
+
+        void seek() {
+            rng ^= rng << 13;
+            rng ^= rng >> 7;
+            rng ^= rng << 17;
+            const char bucket = (char)(rng % buckets);
+            append_frame(outbox, commands::MATCH, &bucket, 1);
+            asked = std::chrono::steady_clock::now();
+        }
+
+        void do_read() {
+            auto self(shared_from_this());
+            socket_.async_read_some(boost::asio::buffer(in),
+                [this, self](boost::system::error_code ec, std::size_t length) {
+                    if (ec) {
+                        return;
+                    }
+                    reader.feed(in, length);
+                    char command;
+                    const char* payload;
+                    size_t payload_length;
+                    while (reader.next(command, payload, payload_length)) {
+                        if (command == commands::MATCH) {
+                            if (measuring.load(std::memory_order_relaxed)) {
+                                samples.push_back(std::chrono::duration_cast<std::chrono::microseconds>(
+                                            std::chrono::steady_clock::now() - asked).count());
+                                matches.fetch_add(1, std::memory_order_relaxed);
+                            }
+                        } else if (command == success_fail::SUCCESS) {
+                            // seated, leave and queue again
+                            append_frame(outbox, commands::OUT);
+                            seek();
+                        } else if (command == success_fail::FAIL) {
+                            // refused while the server sheds load, ask again a little later
+                            failures++;
+                            retry();
+                        }
+                    }
+                    flush();
+                    do_read();
+                });
+        }
+
+        void retry() {
+            auto self(shared_from_this());
+            timer.expires_after(std::chrono::milliseconds(RETRY_MILLISECONDS));
+            timer.async_wait([this, self](boost::system::error_code ec) {
+                    if (!ec && socket_.is_open()) {
+                        seek();
+                        flush();
+                    }
+                    });
+        }
+
+        void flush() {
+            if (writing || outbox.empty()) {
+                return;
+            }
+            auto self(shared_from_this());
+            writing = true;
+            out.swap(outbox);
+            outbox.clear();
+            boost::asio::async_write(socket_, boost::asio::buffer(out),
+                [this, self](boost::system::error_code ec, std::size_t) {
+                    writing = false;
+                    if (!ec) {
+                        flush();
+                    }
+                });
+        }
+
+        stream_socket socket_;
+        boost::asio::steady_timer timer;
+        const int buckets;
+        uint64_t rng;
+        bool writing;
+        std::string outbox;
+        std::string out;
+        char in[4096];
+        frame_reader reader;
+        std::chrono::steady_clock::time_point asked;
+        std::vector<uint32_t> samples;
+};
+
+uint32_t percentile(const std::vector<uint32_t>& sorted, double p) {
+    if (sorted.empty()) {
+        return 0;
+    }
+    return sorted[std::min(sorted.size() - 1, (size_t)(p * sorted.size()))];
+}
+
+// metrics text from the admin endpoint of the server, empty if unavailable
+std::string fetch_metrics(const std::string& host, const std::string& port) {
+    try {
+        boost::asio::io_context io_context;
+        tcp::socket socket(io_context);
+        boost::asio::connect(socket, tcp::resolver(io_context).resolve(host, port));
+        const std::string request = "GET /metrics HTTP/1.0\r\n\r\n";
+        boost::asio::write(socket, boost::asio::buffer(request));
+        std::string response;
+        char buffer[4096];
+        boost::system::error_code ec;
+        while (size_t length = socket.read_some(boost::asio::buffer(buffer), ec)) {
+            response.append(buffer, length);
+        }
+        return response;
+    } catch (std::exception& e) {
+        return "";
+    }
+}
+
+// value of metric name in metrics text, -1 if missing
+int64_t metric(const std::string& text, const std::string& name) {
+    const size_t at = text.find("\n" + name + " ");
+    return at == std::string::npos ? -1 : atoll(text.c_str() + at + name.length() + 2);
+}
+
+// Blocking client for the worker check, a read gives up after a second.
+class probe {
+    public:
+        probe(boost::asio::io_context& io_context, const std::vector<stream_endpoint>& endpoints): s(io_context) {
+            boost::asio::connect(s, endpoints);
+        }
+
+        void send(char command, const std::string& payload = "") {
+            std::string frame;
+            append_frame(frame, command, payload.data(), payload.length());
+            boost::asio::write(s, boost::asio::buffer(frame));
+        }
+
+        // log in as player, false unless seated
+        bool login(int player, const std::string& room_name) {
+            send(commands::IN, (char)(player + 1) + room_name);
+            return seated();
+        }
+
+        // room of the answer to a MATCH sent before, empty unless seated
+        std::string matched() {
+            char command;
+            std::string reply;
+            if (!next(command, reply) || command != commands::MATCH || reply.length() < 2 || !seated()) {
+                return "";
+            }
+            return reply.substr(1);
+        }
+
+        // true if key arrives next
+        bool receives(char key) {
+            char command;
+            std::string payload;
+            return next(command, payload) && command == commands::PUT && payload == std::string(1, key);
+        }
+    private:
+        static constexpr int TIMEOUT_MILLISECONDS = 1000;
+
+        // the login reply, the snapshot and the keys of the turn
+        bool seated() {
+            char command;
+            std::string payload;
+            snapshot_message snap;
+            if (!next(command, payload) || command != success_fail::SUCCESS || !next(command, payload) ||
+                    command != commands::SNAPSHOT || !snap.decode(payload.data(), payload.length())) {
+                return false;
+            }
+            for (int k = 0; k < snap.turn_keys; k++) {
+                if (!next(command, payload)) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        bool next(char& command, std::string& payload) {
+            const char* data;
+            size_t length;
+            while (!reader.next(command, data, length)) {
+                struct pollfd readable = {s.native_handle(), POLLIN, 0};
+                boost::system::error_code ec;
+                if (reader.is_malformed() || poll(&readable, 1, TIMEOUT_MILLISECONDS) != 1) {
+                    return false;
+                }
+                const size_t n = s.read_some(boost::asio::buffer(in), ec);
+                if (ec) {
+                    return false;
+                }
+                reader.feed(in, n);
+            }
+            payload.assign(data, length);
+            return true;
+        }
+
+        stream_socket s;
+        char in[256];
+        frame_reader reader;
+};
+
+// One connection logs in to rooms of two different workers in turn, then
+// matches in a bucket of another worker, each time with a partner
+// connection. The partner's key only reaches it, and the match only pairs
+// them, if every login moved the connection to the worker owning the room.
+int check_workers(boost::asio::io_context& io_context, const std::vector<stream_endpoint>& endpoints, int workers) {
+    const std::string prefix = "roam" + std::to_string(std::chrono::steady_clock::now().time_since_epoch().count()) + "-";
+    const std::string first = prefix + "0";
+    std::string second;
+    for (int k = 1; room_owner(second = prefix + std::to_string(k), workers) == room_owner(first, workers); k++);
+    bool ok = true;
+    probe roaming(io_context, endpoints);
+    for (const std::string& name: {first, second}) {
+        probe partner(io_context, endpoints);
+        bool relayed = roaming.login(0, name) && partner.login(1, name);
+        if (relayed) {
+            partner.send(commands::PUT, "r");
+            relayed = roaming.receives('r');
+        }
+        std::cout << "room of worker " << room_owner(name, workers) << ": " << (relayed ? "ok" : "failed") << "\n";
+        ok = ok && relayed;
+        roaming.send(commands::OUT);
+    }
+    int bucket = 0;
+    while (bucket % workers == room_owner(second, workers)) {
+        bucket++;
+    }
+    probe partner(io_context, endpoints);
+    roaming.send(commands::MATCH, std::string(1, (char)bucket));
+    partner.send(commands::MATCH, std::string(1, (char)bucket));
+    const std::string room_name = roaming.matched();
+    const bool paired = !room_name.empty() && room_name == partner.matched();
+    std::cout << "match of worker " << bucket % workers << ": " << (paired ? "ok" : "failed") << "\n";
+    return ok && paired ? 0 : 1;
+}
+
+// clients keep asking the lobby for matches, report matches/second and time to match
+int run_matching(boost::asio::io_context& io_context, const std::vector<stream_endpoint>& endpoints, int clients, int seconds,
+        int threads, int buckets) {
+    std::vector<std::shared_ptr<seeker> > seekers;
+    for (int c = 0; c < clients; c++) {
+        seekers.push_back(std::make_shared<seeker>(io_context, buckets, c + 1));
+        seekers.back()->start(endpoints);
+    }
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; t++) {
+        workers.emplace_back([&io_context]() { io_context.run(); });
+    }
+    std::cout << clients << " clients matching in " << buckets << " rating buckets, " << threads << " threads\n";
+    measuring.store(true);
+    uint64_t last = 0;
+    for (int s = 1; s <= seconds; s++) {
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+        // both players of a match are told
+        const uint64_t now = matches.load() / NUM_PLAYER;
+        std::cout << s << "s: " << now - last << " matches/s\n";
+        last = now;
+    }
+    measuring.store(false);
+    for (std::shared_ptr<seeker>& s: seekers) {
+        s->stop();
+    }
+    for (std::thread& worker: workers) {
+        worker.join();
+    }
+
+    std::sort(all_samples.begin(), all_samples.end());
+    std::cout << "throughput: " << matches.load() / NUM_PLAYER / std::max(1, seconds) << " matches/s, "
+              << failures.load() << " failed\n";
+    std::cout << "time to match microseconds: p50 " << percentile(all_samples, 0.5) << ", p99 " << percentile(all_samples, 0.99)
+              << ", p999 " << percentile(all_samples, 0.999) << ", max " << (all_samples.empty() ? 0 : all_samples.back()) << "\n";
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    const char* usage = " [-h host] [-p port] [-c clients] [-d seconds] [-t threads] [-w window] [-r rate] [-k keys] [-s spectators]"
+        " [-a admin port] [-m rating buckets] [-x workers]\n";
+    std::string host = "localhost";
+    std::string port = "8711";
+    int clients = 2000;
+    int seconds = 10;
+    int threads = std::max(1, (int)std::thread::hardware_concurrency());
+    int spectators = 0;
+    std::string admin_port;
+    int buckets = 0;
+    int server_workers = 0;
+    options opts;
+    int opt;
+    while ((opt = getopt(argc, argv, "h:p:c:d:t:w:r:k:s:a:m:x:")) != -1) {
+        switch (opt) {
+            case 'h':
+                host = optarg;
+                break;
+            case 'p':
+                port = optarg;
+                break;
+            case 'c':
+                clients = atoi(optarg);
+                break;
+            case 'd':
+                seconds = atoi(optarg);
+                break;
+            case 't':
+                threads = atoi(optarg);
+                break;
+            case 'w':
+                opts.window = atoi(optarg);
+                break;
+            case 'r':
+                opts.rate = atoi(optarg);
+                break;
+            case 'k':
+                opts.script = optarg;
+                break;
+            case 's':
+                spectators = atoi(optarg);
+                break;
+            case 'a':
+                admin_port = optarg;
+                break;
+            case 'm':
+                buckets = std::min(atoi(optarg), 256);
+                break;
+            case 'x':
+                server_workers = atoi(optarg);
+                break;
+            default:
+                std::cerr << "Usage: " << argv[0] << usage;
+                return 1;
+        }
+    }
+    const int rooms = std::max(1, clients / NUM_PLAYER);
+    clients = rooms * NUM_PLAYER;
+
+    boost::asio::io_context io_context;
+    const std::vector<stream_endpoint> endpoints = resolve_stream(io_context, host, port);
+    if (server_workers > 1) {
+        return check_workers(io_context, endpoints, server_workers);
+    }
+    if (buckets > 0) {
+        return run_matching(io_context, endpoints, clients, seconds, threads, buckets);
+    }
+    std::vector<std::shared_ptr<player> > players;
+    std::vector<std::shared_ptr<player> > drivers;
+    const std::string prefix = "load" + std::to_string(std::chrono::steady_clock::now().time_since_epoch().count()) + "-";
+    for (int r = 0; r < rooms; r++) {
+        for (int i = 0; i < NUM_PLAYER; i++) {
+            players.push_back(std::make_shared<player>(io_context, prefix + std::to_string(r), i, opts, players.size() + 1));
+            players.back()->start(endpoints);
+            if (i == 0) {
+                drivers.push_back(players.back());
+            }
+        }
+        for (int k = 0; k < spectators; k++) {
+            players.push_back(std::make_shared<player>(io_context, prefix + std::to_string(r), SPECTATOR, opts, players.size() + 1));
+            players.back()->start(endpoints);
+        }
+    }
+    clients = players.size();
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; t++) {
+        workers.emplace_back([&io_context]() { io_context.run(); });
+    }
+
+    std::cout << clients << " clients in " << rooms << " rooms (" << spectators << " spectators each), " << threads << " threads, "
+              << (opts.rate > 0 ? std::to_string(opts.rate) + " keys/s per room" : std::to_string(opts.window) + " keys in flight per room")
+              << "\n";
+    const std::chrono::steady_clock::time_point login_deadline = std::chrono::steady_clock::now() +
+        std::chrono::seconds(LOGIN_SECONDS);
+    while (logged_in_count.load() + (int)failures.load() < clients) {
+        if (std::chrono::steady_clock::now() > login_deadline) {
+            std::cerr << clients - logged_in_count.load() - (int)failures.load() << " clients not answered after " << LOGIN_SECONDS
+                      << " seconds, stopping.\n";
+            for (std::shared_ptr<player>& p: players) {
+                p->stop();
+            }
+            for (std::thread& worker: workers) {
+                worker.join();
+            }
+            return 1;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    std::cout << logged_in_count.load() << " logged in, " << failures.load() << " failed\n";
+    measuring.store(true);
+    for (std::shared_ptr<player>& p: drivers) {
+        p->drive();
+    }
+
+    // server heap allocations per key over all but the first second, once buffers have grown
+    const std::string put_metric = "cc_messages_total{command=\"put\"}";
+    const std::string allocation_metric = "cc_heap_allocations_total";
+    std::string warm;
+    uint64_t last = 0;
+    for (int s = 1; s <= seconds; s++) {
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+        const uint64_t now = round_trips.load();
+        std::cout << s << "s: " << now - last << " round trips/s\n";
+        last = now;
+        if (s == 1 && !admin_port.empty()) {
+            warm = fetch_metrics(host, admin_port);
+        }
+    }
+    const std::string done = admin_port.empty() ? "" : fetch_metrics(host, admin_port);
+    measuring.store(false);
+
+    for (std::shared_ptr<player>& p: players) {
+        p->stop();
+    }
+    for (std::thread& worker: workers) {
+        worker.join();
+    }
+
+    std::sort(all_samples.begin(), all_samples.end());
+    const uint64_t total = round_trips.load();
+    std::cout << "throughput: " << total / std::max(1, seconds) << " round trips/s, "
+              << 2 * total / std::max(1, seconds) << " messages/s\n";
+    if (spectators > 0) {
+        std::cout << "spectators: " << watched_keys.load() / std::max(1, seconds) << " keys watched/s\n";
+    }
+    if (!admin_port.empty()) {
+        const int64_t keys = metric(done, put_metric) - metric(warm, put_metric);
+        const int64_t allocations = metric(done, allocation_metric) - metric(warm, allocation_metric);
+        if (metric(warm, allocation_metric) < 0 || metric(done, allocation_metric) < 0) {
+            std::cout << "server allocations: not counted, build it with -DCOUNT_ALLOCATIONS\n";
+        } else {
+            std::cout << "server allocations: " << allocations << " for " << keys << " keys, "
+                      << (double)allocations / std::max<int64_t>(1, keys) << " per key\n";
+        }
+    }
+    std::cout << "round trip microseconds: p50 " << percentile(all_samples, 0.5) << ", p99 " << percentile(all_samples, 0.99)
+              << ", p999 " << percentile(all_samples, 0.999) << ", max " << (all_samples.empty() ? 0 : all_samples.back()) << "\n";
+
+    return 0;
+}
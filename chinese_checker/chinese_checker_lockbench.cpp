@@ -0,0 +1,121 @@
+#include <algorithm>      // max
+#include <atomic>         // atomic_flag
+#include <chrono>         // steady_clock, duration
+#include <cstdint>        // uint64_t
+#include <cstdio>         // printf
+#include <cstdlib>        // atoi
+#include <iostream>       // cerr
+#include <mutex>          // mutex
+#include <sys/resource.h> // getrusage
+#include <thread>         // thread
+#include <unistd.h>       // getopt
+#include <vector>         // vector
+
+#include "lockable.hpp"
+
+// Contention benchmark for lockable. Threads take the same lock in a loop,
+// do some work holding it and some between, with every thread count from
+// one to -t doubling. Each lock is measured the same way: the test and set
+// spin lockable used before, lockable, and std::mutex. Reports locks/second
+// and the CPU time spent per lock, which shows spinning that wall time
+// hides when threads outnumber cores.
+
+// lockable before it parked waiters
+class spin_lock {
+    public:
+        spin_lock(): _lock(ATOMIC_FLAG_INIT) {}
+
+        void lock() {
+            while (_lock.test_and_set(std::memory_order_acquire));
+        }
+
+        void unlock() {
+            _lock.clear(std::memory_order_release);
+        }
+    private:
+        std::atomic_flag _lock;
+};
+
+struct options {
+    int max_threads = 8;
+    int locks = 200000;
+    int inside = 50;
+    int outside = 200;
+};
+
+// shared by the threads, changed under the lock only
+volatile uint64_t counter;
+
+inline void work(int steps, volatile uint64_t& v) {
+    for (int i = 0; i < steps; i++) {
+        v = v + 1;
+    }
+}
+
+double cpu_seconds() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+template <typename Lock>
+void measure(const char* name, int threads, const options& opts) {
+    Lock l;
+    counter = 0;
+    const double cpu_start = cpu_seconds();
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::vector<std::thread> running;
+    for (int t = 0; t < threads; t++) {
+        running.emplace_back([&l, &opts]() {
+                volatile uint64_t local = 0;
+                for (int i = 0; i < opts.locks; i++) {
+                    l.lock();
+                    work(opts.inside, counter);
+                    l.unlock();
+                    work(opts.outside, local);
+                }
+                });
+    }
+    for (std::thread& t: running) {
+        t.join();
+    }
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    const double cpu = cpu_seconds() - cpu_start;
+    const double locks = (double)threads * opts.locks;
+    printf("%-10s %2d threads: %8.0f locks/s, %6.0f ns CPU per lock%s\n", name, threads, locks / seconds, cpu / locks * 1e9,
+            counter == (uint64_t)locks * opts.inside ? "" : ", counter wrong");
+}
+
+int main(int argc, char* argv[]) {
+    const char* usage = " [-t max threads] [-n locks per thread] [-i work inside] [-o work outside]\n";
+    options opts;
+    int opt;
+    while ((opt = getopt(argc, argv, "t:n:i:o:")) != -1) {
+        switch (opt) {
+            case 't':
+                opts.max_threads = std::max(1, std::atoi(optarg));
+                break;
+            case 'n':
+                opts.locks = std::max(1, std::atoi(optarg));
+                break;
+            case 'i':
+                opts.inside = std::max(0, std::atoi(optarg));
+                break;
+            case 'o':
+                opts.outside = std::max(0, std::atoi(optarg));
+                break;
+            default:
+                std::cerr << "Usage: " << argv[0] << usage;
+                return 1;
+        }
+    }
+    printf("%u cores, %d locks per thread, %d steps inside, %d outside\n", std::thread::hardware_concurrency(), opts.locks,
+            opts.inside, opts.outside);
+    for (int threads = 1; threads <= opts.max_threads; threads *= 2) {
+        measure<spin_lock>("spin", threads, opts);
+        measure<lockable>("lockable", threads, opts);
+        measure<std::mutex>("std::mutex", threads, opts);
+    }
+
+    return 0;
+}
@@ -0,0 +1,213 @@
+#include <algorithm>          // max, sort
+#include <atomic>             // atomic
+#include <chrono>             // steady_clock, duration, microseconds, nanoseconds
+#include <condition_variable> // condition_variable
+#include <cstdint>            // int64_t
+#include <cstdio>             // printf
+#include <cstdlib>            // atoi
+#include <iostream>           // cerr
+#include <mutex>              // mutex, unique_lock
+#include <queue>              // queue
+#include <thread>             // thread, this_thread
+#include <unistd.h>           // getopt
+#include <vector>             // vector
+
+#include "control_source.hpp"
+#include "lockable.hpp"
+
+// Benchmark for blocking_queue. Throughput: producers put keys as fast as
+// they can, one at a time or in batches with put_n and drain, and one
+// consumer takes them. Wakeup latency: the consumer sleeps in get until a
+// producer puts a key every few hundred microseconds, and the delay from
+// the put to get returning is measured. The queues blocking_queue replaced
+// run the same way: a std::queue under lockable polled with has_next, and a
+// std::queue under a mutex with a condition variable.
+
+// blocking_queue<true> before: a std::queue under lockable, polled
+class locked_queue: public lockable {
+    public:
+        void put(char c) {
+            ATOMIC_RUN(
+                    q.push(c);
+                    )
+        }
+
+        char get() {
+            for (;;) {
+                ATOMIC_RUN(
+                        const bool ready = !q.empty();
+                        char c = ready ? q.front() : 0;
+                        if (ready) {
+                            q.pop();
+                        }
+                        )
+                if (ready) {
+                    return c;
+                }
+                std::this_thread::yield();
+            }
+        }
+    private:
+        std::queue<char> q;
+};
+
+// blocking_queue<false> before, without waiting for the queue to empty on put
+class condition_queue {
+    public:
+        void put(char c) {
+            std::unique_lock<std::mutex> lck(mtx);
+            q.push(c);
+            cv.notify_one();
+        }
+
+        char get() {
+            std::unique_lock<std::mutex> lck(mtx);
+            while (q.empty()) {
+                cv.wait(lck);
+            }
+            char c = q.front();
+            q.pop();
+            return c;
+        }
+    private:
+        std::queue<char> q;
+        std::condition_variable cv;
+        std::mutex mtx;
+};
+
+struct options {
+    int producers = 4;
+    int keys = 2000000;
+    int batch = 64;
+    int wakeups = 2000;
+    int gap_microseconds = 200;
+};
+
+// keys a second through q from producers one at a time
+template <typename Queue>
+void throughput(const char* name, int producers, const options& opts) {
+    Queue q;
+    const int per_producer = opts.keys / producers;
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::vector<std::thread> running;
+    for (int p = 0; p < producers; p++) {
+        running.emplace_back([&q, per_producer]() {
+                for (int i = 0; i < per_producer; i++) {
+                    q.put('a' + i % 26);
+                }
+                });
+    }
+    int64_t sum = 0;
+    for (int i = 0; i < per_producer * producers; i++) {
+        sum += q.get();
+    }
+    for (std::thread& t: running) {
+        t.join();
+    }
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    printf("%-24s %d producers: %10.0f keys/s%s\n", name, producers, per_producer * producers / seconds,
+            sum > 0 ? "" : ", no keys");
+}
+
+// the same with put_n and drain
+template <typename Queue>
+void batch_throughput(const char* name, int producers, const options& opts) {
+    Queue q;
+    const int per_producer = opts.keys / producers / opts.batch * opts.batch;
+    const int batch = opts.batch;
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::vector<std::thread> running;
+    for (int p = 0; p < producers; p++) {
+        running.emplace_back([&q, per_producer, batch]() {
+                std::vector<char> keys(batch, 'a');
+                for (int i = 0; i < per_producer; i += batch) {
+                    q.put_n(keys.data(), batch);
+                }
+                });
+    }
+    std::vector<char> keys(batch);
+    int taken = 0;
+    while (taken < per_producer * producers) {
+        const size_t n = q.drain(keys.data(), batch);
+        if (n == 0) {
+            keys[0] = q.get();
+            taken++;
+        }
+        taken += n;
+    }
+    for (std::thread& t: running) {
+        t.join();
+    }
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    printf("%-24s %d producers: %10.0f keys/s\n", name, producers, per_producer * producers / seconds);
+}
+
+// delay from a put to get returning in a consumer that waits for it
+template <typename Queue>
+void wakeup_latency(const char* name, const options& opts) {
+    Queue q;
+    std::atomic<int64_t> put_time(0);
+    std::thread producer([&q, &put_time, &opts]() {
+            for (int i = 0; i < opts.wakeups; i++) {
+                std::this_thread::sleep_for(std::chrono::microseconds(opts.gap_microseconds));
+                put_time.store(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                            std::chrono::steady_clock::now().time_since_epoch()).count());
+                q.put('a');
+            }
+            });
+    std::vector<int64_t> samples;
+    for (int i = 0; i < opts.wakeups; i++) {
+        q.get();
+        const int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+        samples.push_back(now - put_time.load());
+    }
+    producer.join();
+    std::sort(samples.begin(), samples.end());
+    printf("%-24s wakeup microseconds: p50 %.1f, p99 %.1f\n", name, samples[samples.size() / 2] / 1000.0,
+            samples[samples.size() * 99 / 100] / 1000.0);
+}
+
+int main(int argc, char* argv[]) {
+    const char* usage = " [-p max producers] [-n keys] [-b batch] [-w wakeups] [-g gap microseconds]\n";
+    options opts;
+    int opt;
+    while ((opt = getopt(argc, argv, "p:n:b:w:g:")) != -1) {
+        switch (opt) {
+            case 'p':
+                opts.producers = std::max(1, std::atoi(optarg));
+                break;
+            case 'n':
+                opts.keys = std::max(1, std::atoi(optarg));
+                break;
+            case 'b':
+                opts.batch = std::max(1, std::atoi(optarg));
+                break;
+            case 'w':
+                opts.wakeups = std::max(1, std::atoi(optarg));
+                break;
+            case 'g':
+                opts.gap_microseconds = std::max(0, std::atoi(optarg));
+                break;
+            default:
+                std::cerr << "Usage: " << argv[0] << usage;
+                return 1;
+        }
+    }
+    printf("%u cores, %d keys, batches of %d\n", std::thread::hardware_concurrency(), opts.keys, opts.batch);
+    throughput<locked_queue>("std::queue, lockable", 1, opts);
+    throughput<condition_queue>("std::queue, mutex", 1, opts);
+    throughput<blocking_queue<true> >("blocking_queue", 1, opts);
+    batch_throughput<blocking_queue<true> >("blocking_queue batches", 1, opts);
+    if (opts.producers > 1) {
+        throughput<locked_queue>("std::queue, lockable", opts.producers, opts);
+        throughput<condition_queue>("std::queue, mutex", opts.producers, opts);
+        throughput<blocking_queue<true, true> >("blocking_queue", opts.producers, opts);
+        batch_throughput<blocking_queue<true, true> >("blocking_queue batches", opts.producers, opts);
+    }
+    wakeup_latency<locked_queue>("std::queue, lockable", opts);
+    wakeup_latency<condition_queue>("std::queue, mutex", opts);
+    wakeup_latency<blocking_queue<true> >("blocking_queue", opts);
+
+    return 0;
+}
@@ -0,0 +1,440 @@
+#include <algorithm>     // max, min, sort
+#include <atomic>        // atomic
+#include <chrono>        // steady_clock, microseconds
+#include <cstdint>       // uint32_t, uint64_t
+#include <cstdlib>       // atof, atoi
+#include <deque>         // deque
+#include <iostream>      // cout, cerr
+#include <map>           // map
+#include <memory>        // shared_ptr, make_shared
+#include <mutex>         // mutex, lock_guard
+#include <string>        // string
+#include <thread>        // thread
+#include <unistd.h>      // getopt
+#include <unordered_map> // unordered_map
+#include <vector>        // vector
+
+#include <boost/asio.hpp>
+
+#include "capture.hpp"
+#include "common.hpp"
+#include "game_board.hpp"
+#include "lockable.hpp"
+#include "transport.hpp"
+
+// Replays a capture of chinese_checker_server against a server. Every
+// captured session connects when it first sent a frame and sends its frames
+// at their captured times divided by the speed, or back to back at maximum
+// speed, and half closes the connection when the captured session ended.
+// Each message is timed: a login or match until its reply, a key until the
+// opponent receives it. Keys are relayed in order, so a FIFO of send times
+// per player and room gives the delivery time; keys sent while the opponent
+// is not in the room are not timed.
+
+enum sample_kind {
+    LOGIN,
+    MATCH,
+    KEY,
+    // how late frames were sent against the schedule
+    LAG,
+    NUM_KINDS
+};
+
+std::atomic<uint64_t> sent_messages(0);
+std::atomic<uint64_t> failures(0);
+
+std::mutex samples_mtx;
+std::vector<uint32_t> all_samples[NUM_KINDS];
+
+// keys in flight in a room, shared by the sessions of its players
+struct replay_room: public lockable {
+    std::deque<std::chrono::steady_clock::time_point> keys[NUM_PLAYER];
+    bool present[NUM_PLAYER] = {false, false};
+};
+
+class room_directory {
+    public:
+        std::shared_ptr<replay_room> get(const std::string& name) {
+            std::lock_guard<std::mutex> lck(mtx);
+            std::shared_ptr<replay_room>& r = rooms[name];
+            if (!r) {
+                r = std::make_shared<replay_room>();
+            }
+            return r;
+        }
+    private:
+        std::mutex mtx;
+        std::unordered_map<std::string, std::shared_ptr<replay_room> > rooms;
+};
+
+// frames of one captured session in order, and whether it ended in the capture
+struct replay_script {
+    std::vector<captured_message> messages;
+    uint64_t end = 0;
+    bool ended = false;
+};
+
+class replay_session: public std::enable_shared_from_this<replay_session> {
+    public:
+        replay_session(boost::asio::io_context& io_context, room_directory& rooms, const replay_script& script,
+                std::chrono::steady_clock::time_point start, uint64_t first, double speed):
+            socket_(boost::asio::make_strand(io_context)), timer(socket_.get_executor()), rooms(rooms), script(script),
+            start(start), first(first), speed(speed), next_message(0), player(SPECTATOR), login_pending(false),
+            match_pending(false), awaiting_reply(false), skip_keys(0), writing(false), closing(false) {}
+
+        void start_at(const std::vector<stream_endpoint>& endpoints) {
+            auto self(shared_from_this());
+            timer.expires_at(due(script.messages.front().time));
+            timer.async_wait([this, self, endpoints](boost::system::error_code) {
+                    boost::asio::async_connect(socket_, endpoints,
+                        [this, self](boost::system::error_code ec, const stream_endpoint&) {
+                            if (ec) {
+                                failures++;
+                                return;
+                            }
+                            set_no_delay(socket_);
+                            send_due();
+                            do_read();
+                        });
+                    });
+        }
+
+        ~replay_session() {
+            std::lock_guard<std::mutex> lck(samples_mtx);
+            for (int k = 0; k < NUM_KINDS; k++) {
+                all_samples[k].insert(all_samples[k].end(), samples[k].begin(), samples[k].end());
+            }
+        }
+    private:
+        static constexpr int REPLY_TIMEOUT_MILLISECONDS = 1000;
+
+        std::chrono::steady_clock::time_point due(uint64_t time) const {
+            if (speed <= 0) {
+                return start;
+            }
+            return start + std::chrono::microseconds((uint64_t)((time - first) / speed));
+        }
+
+        static uint32_t since(std::chrono::steady_clock::time_point t) {
+            return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - t).count();
+        }
+
+        // send every frame due by now in one write, then wait for the next one
+        // frames after a login or match wait for its reply, as the client did
+        void send_due() {
+            auto self(shared_from_this());
+            const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+            while (!awaiting_reply && next_message < script.messages.size() && due(script.messages[next_message].time) <= now) {
+                const captured_message& message = script.messages[next_message++];
+                samples[LAG].push_back(since(due(message.time)));
+                sent(message.frame);
+                outbox += message.frame;
+            }
+            flush();
+            if (awaiting_reply) {
+                // a match may never come in a replay, go on without the reply after a while
+                timer.expires_after(std::chrono::milliseconds(REPLY_TIMEOUT_MILLISECONDS));
+                timer.async_wait([this, self](boost::system::error_code ec) {
+                        if (!ec && socket_.is_open() && awaiting_reply) {
+                            awaiting_reply = false;
+                            send_due();
+                        }
+                        });
+                return;
+            }
+            if (next_message < script.messages.size()) {
+                timer.expires_at(due(script.messages[next_message].time));
+                timer.async_wait([this, self](boost::system::error_code ec) {
+                        if (!ec && socket_.is_open()) {
+                            send_due();
+                        }
+                        });
+                return;
+            }
+            // everything is sent, close when the captured session ended
+            timer.expires_at(script.ended ? due(script.end) : now);
+            timer.async_wait([this, self](boost::system::error_code ec) {
+                    if (!ec && socket_.is_open()) {
+                        closing = true;
+                        close_when_written();
+                    }
+                    });
+        }
+
+        // note what a frame sent asks for, to time its answer
+        void sent(const std::string& frame) {
+            sent_messages.fetch_add(1, std::memory_order_relaxed);
+            const char command = frame[1];
+            if (command == commands::IN && frame.length() >= 3) {
+                leave_room();
+                player = seat((int)frame[2] - 1);
+                room_ = rooms.get(frame.substr(3));
+                login_pending = true;
+                awaiting_reply = true;
+                login_sent = std::chrono::steady_clock::now();
+            } else if (command == commands::MATCH) {
+                match_pending = true;
+                awaiting_reply = true;
+                match_sent = std::chrono::steady_clock::now();
+            } else if (command == commands::OUT) {
+                leave_room();
+            } else if (command == commands::PUT && room_ && player != SPECTATOR) {
+                replay_room& r = *room_;
+                r.lock();
+                if (r.present[1 - player]) {
+                    r.keys[player].push_back(std::chrono::steady_clock::now());
+                }
+                r.unlock();
+            }
+        }
+
+        void leave_room() {
+            if (room_ && player != SPECTATOR) {
+                replay_room& r = *room_;
+                r.lock();
+                r.present[player] = false;
+                r.keys[1 - player].clear();
+                r.unlock();
+            }
+            room_.reset();
+        }
+
+        void do_read() {
+            auto self(shared_from_this());
+            socket_.async_read_some(boost::asio::buffer(in),
+                [this, self](boost::system::error_code ec, std::size_t length) {
+                    if (ec) {
+                        leave_room();
+                        return;
+                    }
+                    reader.feed(in, length);
+                    char command;
+                    const char* payload;
+                    size_t payload_length;
+                    while (reader.next(command, payload, payload_length)) {
+                        received(command, payload, payload_length);
+                    }
+                    do_read();
+                });
+        }
+
+        void received(char command, const char* payload, size_t length) {
+            if (command == commands::MATCH && length >= 2) {
+                if (match_pending) {
+                    samples[MATCH].push_back(since(match_sent));
+                    match_pending = false;
+                }
+                // the reply to the login to the seat follows
+                leave_room();
+                player = seat((int)payload[0] - 1);
+                room_ = rooms.get(std::string(payload + 1, length - 1));
+            } else if (command == success_fail::SUCCESS || command == success_fail::FAIL) {
+                if (login_pending) {
+                    samples[LOGIN].push_back(since(login_sent));
+                    login_pending = false;
+                }
+                if (command == success_fail::FAIL) {
+                    failures++;
+                    match_pending = false;
+                } else if (room_ && player != SPECTATOR) {
+                    replay_room& r = *room_;
+                    r.lock();
+                    r.present[player] = true;
+                    r.unlock();
+                }
+                if (awaiting_reply) {
+                    awaiting_reply = false;
+                    timer.cancel();
+                    send_due();
+                }
+            } else if (command == commands::SNAPSHOT) {
+                snapshot_message snapshot;
+                if (snapshot.decode(payload, length)) {
+                    // keys of the turn so far, sent before this login
+                    skip_keys = snapshot.turn_keys;
+                }
+            } else if (command == commands::PUT) {
+                if (skip_keys > 0) {
+                    skip_keys--;
+                } else if (room_ && player != SPECTATOR) {
+                    replay_room& r = *room_;
+                    bool timed = false;
+                    std::chrono::steady_clock::time_point put_time;
+                    r.lock();
+                    if (!r.keys[1 - player].empty()) {
+                        put_time = r.keys[1 - player].front();
+                        r.keys[1 - player].pop_front();
+                        timed = true;
+                    }
+                    r.unlock();
+                    if (timed) {
+                        samples[KEY].push_back(since(put_time));
+                    }
+                }
+            }
+        }
+
+        void flush() {
+            if (writing || outbox.empty()) {
+                return;
+            }
+            auto self(shared_from_this());
+            writing = true;
+            out.swap(outbox);
+            outbox.clear();
+            boost::asio::async_write(socket_, boost::asio::buffer(out),
+                [this, self](boost::system::error_code ec, std::size_t) {
+                    writing = false;
+                    if (!ec) {
+                        flush();
+                        close_when_written();
+                    }
+                });
+        }
+
+        // half close once the last frame is written, the server answers what it read and closes
+        void close_when_written() {
+            if (closing && !writing && outbox.empty()) {
+                boost::system::error_code ec;
+                socket_.shutdown(stream_socket::shutdown_send, ec);
+            }
+        }
+
+        // player timed for a login, invalid players are not timed
+        static int seat(int player) {
+            return player >= 0 && player < NUM_PLAYER ? player : SPECTATOR;
+        }
+
+        stream_socket socket_;
+        boost::asio::steady_timer timer;
+        room_directory& rooms;
+        const replay_script& script;
+        const std::chrono::steady_clock::time_point start;
+        const uint64_t first;
+        const double speed;
+        size_t next_message;
+        std::shared_ptr<replay_room> room_;
+        int player;
+        bool login_pending;
+        std::chrono::steady_clock::time_point login_sent;
+        bool match_pending;
+        std::chrono::steady_clock::time_point match_sent;
+        bool awaiting_reply;
+        int skip_keys;
+        bool writing;
+        bool closing;
+        std::string outbox;
+        std::string out;
+        char in[4096];
+        frame_reader reader;
+        std::vector<uint32_t> samples[NUM_KINDS];
+};
+
+constexpr int replay_session::REPLY_TIMEOUT_MILLISECONDS;
+
+uint32_t percentile(const std::vector<uint32_t>& sorted, double p) {
+    if (sorted.empty()) {
+        return 0;
+    }
+    return sorted[std::min(sorted.size() - 1, (size_t)(p * sorted.size()))];
+}
+
+void report(const std::string& name, std::vector<uint32_t>& samples) {
+    std::sort(samples.begin(), samples.end());
+    std::cout << name << " microseconds: " << samples.size() << " timed, p50 " << percentile(samples, 0.5)
+              << ", p99 " << percentile(samples, 0.99) << ", p999 " << percentile(samples, 0.999)
+              << ", max " << (samples.empty() ? 0 : samples.back()) << "\n";
+}
+
+int main(int argc, char* argv[]) {
+    const char* usage = " [-h host] [-p port] [-s speed, 0 for maximum] [-t threads] <capture>...\n";
+    std::string host = "localhost";
+    std::string port = "8711";
+    double speed = 1;
+    int threads = std::max(1, (int)std::thread::hardware_concurrency());
+    int opt;
+    while ((opt = getopt(argc, argv, "h:p:s:t:")) != -1) {
+        switch (opt) {
+            case 'h':
+                host = optarg;
+                break;
+            case 'p':
+                port = optarg;
+                break;
+            case 's':
+                speed = atof(optarg);
+                break;
+            case 't':
+                threads = std::max(1, atoi(optarg));
+                break;
+            default:
+                std::cerr << "Usage: " << argv[0] << usage;
+                return 1;
+        }
+    }
+    if (optind >= argc) {
+        std::cerr << "Usage: " << argv[0] << usage;
+        return 1;
+    }
+
+    // sessions of every file, the captures of workers of one server side by side
+    std::map<uint64_t, replay_script> scripts;
+    uint64_t first = UINT64_MAX;
+    uint64_t last = 0;
+    for (int a = optind; a < argc; a++) {
+        capture_reader reader;
+        if (!reader.open(argv[a])) {
+            std::cerr << "Not a capture file: " << argv[a] << "\n";
+            return 1;
+        }
+        captured_message message;
+        while (reader.next(message)) {
+            replay_script& script = scripts[(uint64_t)(a - optind) << 48 | message.session];
+            if (message.frame.empty()) {
+                script.ended = true;
+                script.end = message.time;
+            } else {
+                script.messages.push_back(message);
+            }
+            first = std::min(first, message.time);
+            last = std::max(last, message.time);
+        }
+    }
+    uint64_t messages = 0;
+    for (std::map<uint64_t, replay_script>::iterator it = scripts.begin(); it != scripts.end(); ) {
+        messages += it->second.messages.size();
+        it = it->second.messages.empty() ? scripts.erase(it) : std::next(it);
+    }
+    if (scripts.empty()) {
+        std::cerr << "Nothing to replay\n";
+        return 1;
+    }
+
+    boost::asio::io_context io_context;
+    const std::vector<stream_endpoint> endpoints = resolve_stream(io_context, host, port);
+    room_directory rooms;
+    std::cout << scripts.size() << " sessions, " << messages << " messages over " << (last - first) / 1000000.0
+              << " s captured, replaying at " << (speed > 0 ? std::to_string(speed) + "x" : std::string("maximum speed"))
+              << " on " << threads << " threads\n";
+    // sessions connect in the first few milliseconds of the replay, not at once when starting late
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now() + std::chrono::milliseconds(100);
+    for (std::pair<const uint64_t, replay_script>& s: scripts) {
+        std::make_shared<replay_session>(io_context, rooms, s.second, start, first, speed)->start_at(endpoints);
+    }
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; t++) {
+        workers.emplace_back([&io_context]() { io_context.run(); });
+    }
+    for (std::thread& worker: workers) {
+        worker.join();
+    }
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::cout << "replayed " << sent_messages.load() << " messages in " << seconds << " s, "
+              << (uint64_t)(sent_messages.load() / std::max(seconds, 1e-6)) << " messages/s, " << failures.load() << " failed\n";
+    report("login", all_samples[LOGIN]);
+    report("match", all_samples[MATCH]);
+    report("key delivery", all_samples[KEY]);
+    report("send lag", all_samples[LAG]);
+    return 0;
+}
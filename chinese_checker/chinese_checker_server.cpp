@@ -1,219 +1,1733 @@
-#include <cstdlib>       // atoi
+#include <algorithm>     // max, sort
+#include <atomic>        // atomic
+#include <chrono>        // steady_clock
+#include <cstdint>       // int64_t, uint32_t
+#include <functional>    // hash, function
+#include <csignal>       // SIGINT, SIGTERM, kill
+#include <cstdlib>       // atoi, malloc, free
 #include <exception>     // exception
+#include <new>           // bad_alloc
 #include <iostream>      // cout, cerr
-#include <queue>         // queue
+#include <memory>        // shared_ptr, make_shared
 #include <string>        // string
+#include <thread>        // thread
+#include <sys/socket.h>  // SOL_SOCKET, SO_REUSEPORT
+#include <sys/wait.h>    // waitpid
+#ifdef __linux__
+#include <sys/prctl.h>   // prctl
+#endif
+#include <unistd.h>      // getopt, fork
 #include <unordered_map> // unordered_map
+#include <vector>        // vector
 
 #include <boost/asio.hpp>
+#include <boost/version.hpp>
 
+#ifdef USE_IO_URING
+// sockets run on io_uring only when Asio has it and epoll is disabled
+#if BOOST_VERSION < 107800 || !defined(BOOST_ASIO_HAS_IO_URING) || !defined(BOOST_ASIO_DISABLE_EPOLL)
+#error "USE_IO_URING needs Boost 1.78 or later, BOOST_ASIO_HAS_IO_URING and BOOST_ASIO_DISABLE_EPOLL"
+#endif
+#endif
+
+#include "async_logger.hpp"
+#include "capture.hpp"
+#include "cluster.hpp"
 #include "common.hpp"
 #include "control_source.hpp"
+#include "event_log.hpp"
+#include "game_board.hpp"
+#include "handler_memory.hpp"
+#include "metrics.hpp"
+#include "object_pool.hpp"
+#include "room_store.hpp"
+#include "transport.hpp"
 
 constexpr char KEY_MAP[] = "dbcazfgknjhluiopqrstmvxwye";
 
+#ifdef COUNT_ALLOCATIONS
+// heap allocations of the whole process, reported by the admin endpoint
+std::atomic<int64_t> heap_allocations(0);
+
+void* operator new(std::size_t size) {
+    heap_allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(size)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void* p, std::size_t) noexcept {
+    std::free(p);
+}
+#endif
+
 using boost::asio::ip::tcp;
 
-class room: public blocking_queue<true> {
+// caps keeping clients that flood or stop reading from exhausting the server
+struct limits {
+    // connections served at once, more are closed right after accept
+    int max_connections = 10000;
+    // keys kept for the turn in progress, a player sending more before
+    // finishing the move is disconnected; at most 65535 fit a snapshot
+    int max_turn_keys = 4096;
+    // bytes queued for a client before it is dropped, reading from it pauses past a quarter
+    size_t max_backlog = 64 * 1024;
+    // event loop lag past which logins are refused
+    int max_lag_milliseconds = 100;
+};
+
+// frames of a room event, built once and shared by every spectator
+typedef std::shared_ptr<const std::string> shared_frames;
+
+// receives room events pushed to a player or spectator
+class subscriber {
+    public:
+        // keys of the opponent, read from the socket at put_time, called on the room strand
+        virtual void deliver(const std::string& keys, std::chrono::steady_clock::time_point put_time) = 0;
+        // keys played in the room, called on the audience strand
+        virtual void watch(const shared_frames& frames) = 0;
+        // paired by the lobby in bucket as player in room against opponent, called on the lobby strand
+        virtual void matched(const std::string& room, int player, int bucket, const std::shared_ptr<subscriber>& opponent) = 0;
+        // the opponent matched in room left before taking its seat, called on the opponent's strand
+        virtual void abandoned(const std::string& room, int bucket) = 0;
+        // logged out by the room for a turn past the key cap, called on the room strand
+        virtual void dropped() = 0;
+        virtual ~subscriber() {}
+};
+
+typedef boost::asio::strand<boost::asio::io_context::executor_type> strand_type;
+// socket of either transport bound to a strand by type, so operations never wrap the executor in a type erased copy
+typedef stream_socket::rebind_executor<strand_type>::other strand_socket;
+
+// Game room. Every member runs on strand, so rooms need no locks and
+// different rooms run in parallel. The room relays keys between players and
+// plays them on its own board, seen by player 0, so a player logging in
+// gets the game in one snapshot. Spectators are kept on a second strand,
+// audience, so fanning keys out to them never holds up the players.
+class room {
     public:
-        room() {
+        room(boost::asio::io_context& io_context, const std::string& name, const limits& caps, metrics& stats, event_log* log):
+            strand(boost::asio::make_strand(io_context)), audience(boost::asio::make_strand(io_context)), name(name),
+            messages(0), latency_sum(0), audience_size(0), caps(caps), stats(stats), log(log), state(false, 0), sequence(0) {
             for (int i = 0; i < NUM_PLAYER; i++) {
-                has_player[i] = false;
+                players[i] = nullptr;
             }
+            state.init();
+            state.snapshot(turn_start);
         }
 
-        bool player_login(int i) {
-            if (i < 0 || i >= NUM_PLAYER) {
+        // log in player i, snap and turn_keys (in the view of player i) bring the player up to date
+        bool player_login(int i, subscriber* s, snapshot_message& snap, std::string& keys) {
+            if (i < 0 || i >= NUM_PLAYER || players[i]) {
                 return false;
             }
-            lock();
-            if (has_player[i]) {
-                unlock();
-                return false;
-            } else {
-                has_player[i] = true;
-                unlock();
-                return true;
+            players[i] = s;
+            record_event(room_event::LOGIN, i, "");
+            fill_snapshot(snap, keys);
+            if (i == 1) {
+                for (char& c: keys) {
+                    c = mirror(c);
+                }
             }
+            return true;
         }
 
-        bool player_logout(int i) {
-            if (i < 0 || i >= NUM_PLAYER) {
+        // log out s, unless the room already did and the seat was taken again
+        bool player_logout(int i, subscriber* s) {
+            if (i < 0 || i >= NUM_PLAYER || !players[i] || players[i] != s) {
                 return false;
             }
-            lock();
-            if (!has_player[i]) {
-                unlock();
+            players[i] = nullptr;
+            record_event(room_event::LOGOUT, i, "");
+            return true;
+        }
+
+        // play keys of player i and push them to the other player if logged in.
+        // Return frames of the keys played for spectators, null if none or no spectators.
+        // Ignored unless s is logged in as player i. A key past the turn cap
+        // logs s out, so the client logs in again from a snapshot rather than
+        // going on from a board the room no longer follows.
+        shared_frames put(subscriber* s, int i, const std::string& keys, std::chrono::steady_clock::time_point put_time) {
+            if (i < 0 || i >= NUM_PLAYER || players[i] != s) {
+                return nullptr;
+            }
+            const bool watched = audience_size.load(std::memory_order_relaxed) > 0;
+            std::string played;
+            std::string relayed;
+            std::string accepted;
+            bool overflowed = false;
+            for (char c: keys) {
+                const char seen = i == 0 ? c : mirror(c);
+                if (over_limit(i, seen)) {
+                    overflowed = true;
+                    break;
+                }
+                if (play(i, seen) && watched) {
+                    append_frame(played, commands::PUT, &seen, 1);
+                }
+                relayed += mirror(c);
+                if (log) {
+                    accepted += seen;
+                }
+            }
+            if (!accepted.empty()) {
+                record_event(room_event::PUT, i, accepted);
+            }
+            const int to = 1 - i;
+            if (players[to] && !relayed.empty()) {
+                players[to]->deliver(relayed, put_time);
+            }
+            if (overflowed) {
+                stats.add(metrics::TURN_DROPPED);
+                player_logout(i, s);
+                s->dropped();
+            }
+            if (played.empty()) {
+                return nullptr;
+            }
+            return std::allocate_shared<const std::string>(pool_allocator<std::string>(), std::move(played));
+        }
+
+        // game to persist, player 0 view
+        void record(room_record& out) {
+            out.name = name;
+            fill_snapshot(out.snap, out.turn_keys);
+        }
+
+        // continue a persisted game, before anyone logs in
+        void restore(const room_record& record) {
+            state.restore(record.snap.holes, record.snap.current_player);
+            for (char c: record.turn_keys) {
+                state.next(c);
+            }
+            sequence = record.snap.sequence;
+            turn_start = record.snap.holes;
+            turn_keys = record.turn_keys;
+        }
+
+        // snapshot for a spectator about to join, keys in the view of player 0.
+        // Events from now on are broadcast, so spectator_login must be posted to audience next.
+        void spectator_snapshot(snapshot_message& snap, std::string& keys) {
+            audience_size.fetch_add(1, std::memory_order_relaxed);
+            fill_snapshot(snap, keys);
+        }
+
+        // members below run on audience
+
+        void spectator_login(subscriber* s) {
+            spectators.push_back(s);
+        }
+
+        void spectator_logout(subscriber* s) {
+            auto it = std::find(spectators.begin(), spectators.end(), s);
+            if (it != spectators.end()) {
+                *it = spectators.back();
+                spectators.pop_back();
+                audience_size.fetch_sub(1, std::memory_order_relaxed);
+            }
+        }
+
+        // every spectator writes the same frames
+        void broadcast(const shared_frames& frames) {
+            for (subscriber* s: spectators) {
+                s->watch(frames);
+            }
+        }
+
+        // count keys delivered to a player of this room, callable from any thread
+        void record_delivery(int64_t count, int64_t microseconds) {
+            messages.fetch_add(count, std::memory_order_relaxed);
+            latency_sum.fetch_add(count * microseconds, std::memory_order_relaxed);
+        }
+
+        int64_t get_messages() const {
+            return messages.load(std::memory_order_relaxed);
+        }
+
+        int64_t get_latency_sum() const {
+            return latency_sum.load(std::memory_order_relaxed);
+        }
+
+        strand_type strand;
+        strand_type audience;
+        // posts of broadcast, taken on strand and given back on audience
+        handler_memory broadcast_memory;
+        const std::string name;
+    private:
+        std::atomic<int64_t> messages;
+        std::atomic<int64_t> latency_sum;
+        // spectators joined or joining
+        std::atomic<int> audience_size;
+        const limits& caps;
+        metrics& stats;
+        // null unless events are logged
+        event_log* const log;
+
+        static char mirror(char c) {
+            return c >= 'a' && c <= 'z' ? KEY_MAP[c - 'a'] : c;
+        }
+
+        void record_event(char type, int player, const std::string& keys) {
+            if (!log) {
+                return;
+            }
+            room_event event;
+            event.type = type;
+            event.time = std::chrono::duration_cast<std::chrono::microseconds>(
+                    std::chrono::system_clock::now().time_since_epoch()).count();
+            event.sequence = sequence;
+            event.player = player;
+            event.room = name;
+            event.keys = keys;
+            log->append(event);
+        }
+
+        void fill_snapshot(snapshot_message& snap, std::string& keys) {
+            snap.sequence = sequence;
+            snap.current_player = state.get_current_player();
+            snap.turn_keys = turn_keys.length();
+            snap.holes = turn_start;
+            keys = turn_keys;
+        }
+
+        // true if key c of player i no longer fits the turn
+        bool over_limit(int i, char c) {
+            return i == state.get_current_player() && c != 'r' && (int)turn_keys.length() >= caps.max_turn_keys &&
+                !state.finishes_move(c);
+        }
+
+        // play key c of player i seen by player 0, return false for keys out of turn and replays
+        bool play(int i, char c) {
+            if (i != state.get_current_player() || c == 'r') {
                 return false;
-            } else {
-                has_player[i] = false;
-                unlock();
+            }
+            sequence++;
+            const status_type status = state.next(c);
+            if (status == CONTROL_CONT) {
+                turn_keys += c;
                 return true;
             }
+            if (status == PLAYER_WIN) {
+                state.init();
+            }
+            state.snapshot(turn_start);
+            turn_keys.clear();
+            return true;
         }
 
-        bool need_clear() {
-            lock();
-            for (int i = 0; i < NUM_PLAYER; i++) {
-                if (has_player[i]) {
-                    unlock();
-                    return false;
+        std::vector<subscriber*> spectators;
+        subscriber* players[NUM_PLAYER];
+        game_board state;
+        uint32_t sequence;
+        // holes at the start of the turn and keys played since
+        std::string turn_start;
+        std::string turn_keys;
+};
+
+// Room registry split into shards by name, each with its own lock. Shards
+// hold weak references, sessions hold the room from login to logout, and a
+// room leaves its shard when the last handle is released.
+class room_manager {
+    public:
+        room_manager(boost::asio::io_context& io_context, const limits& caps, metrics& stats, event_log* log):
+            io_context(io_context), caps(caps), stats(stats), log(log) {}
+
+        std::shared_ptr<room> get(const std::string& room_name) {
+            shard& s = shards[std::hash<std::string>()(room_name) % NUM_SHARDS];
+            s.lock();
+            std::weak_ptr<room>& entry = s.rooms[room_name];
+            std::shared_ptr<room> r = entry.lock();
+            if (!r) {
+                metrics& stats = this->stats;
+                // rooms and their shared counts come from pools
+                room* p = new (pool_allocator<room>().allocate(1)) room(io_context, room_name, caps, stats, log);
+                r = std::shared_ptr<room>(p, [&s, &stats, room_name](room* p) {
+                        s.release(room_name);
+                        stats.add(metrics::ROOMS, -1);
+                        p->~room();
+                        pool_allocator<room>().deallocate(p, 1);
+                        }, pool_allocator<room>());
+                entry = r;
+                stats.add(metrics::ROOMS);
+            }
+            s.unlock();
+            return r;
+        }
+
+        // every live room, one shard locked at a time
+        std::vector<std::shared_ptr<room> > live_rooms() {
+            std::vector<std::shared_ptr<room> > live;
+            for (shard& s: shards) {
+                s.lock();
+                for (auto& entry: s.rooms) {
+                    if (std::shared_ptr<room> r = entry.second.lock()) {
+                        live.push_back(r);
+                    }
                 }
+                s.unlock();
+            }
+            return live;
+        }
+
+        // call f for every live room
+        void for_each(const std::function<void(const room&)>& f) {
+            for (std::shared_ptr<room>& r: live_rooms()) {
+                f(*r);
             }
-            unlock();
-            return true;
         }
     private:
-        bool has_player[NUM_PLAYER];
+        static constexpr int NUM_SHARDS = 64;
+
+        typedef std::pair<const std::string, std::weak_ptr<room> > entry_type;
+
+        struct shard: public lockable {
+            std::unordered_map<std::string, std::weak_ptr<room>, std::hash<std::string>, std::equal_to<std::string>,
+                pool_allocator<entry_type> > rooms;
+
+            // erase room_name unless it was created again meanwhile
+            void release(const std::string& room_name) {
+                ATOMIC_RUN(
+                        auto it = rooms.find(room_name);
+                        if (it != rooms.end() && it->second.expired()) {
+                            rooms.erase(it);
+                        }
+                        )
+            }
+        };
+
+        boost::asio::io_context& io_context;
+        const limits& caps;
+        metrics& stats;
+        event_log* const log;
+        shard shards[NUM_SHARDS];
 };
 
-class room_manager: public lockable {
+// Event loop lag, sampled by how late a periodic timer fires. The server is
+// saturated while the lag is past the limit.
+class load_monitor {
     public:
-        room* get(std::string room_name) {
-            lock();
-            if (_m.find(room_name) == _m.end()) {
-                _m.emplace(std::piecewise_construct, std::forward_as_tuple(room_name), std::forward_as_tuple());
+        load_monitor(boost::asio::io_context& io_context, int max_lag_milliseconds):
+            timer(io_context), max_lag(max_lag_milliseconds * 1000LL), lag(0) {
+            schedule();
+        }
+
+        bool saturated() const {
+            return lag.load(std::memory_order_relaxed) > max_lag;
+        }
+
+        int64_t get_lag_microseconds() const {
+            return lag.load(std::memory_order_relaxed);
+        }
+    private:
+        static constexpr int INTERVAL_MILLISECONDS = 100;
+
+        void schedule() {
+            timer.expires_after(std::chrono::milliseconds(INTERVAL_MILLISECONDS));
+            timer.async_wait([this](boost::system::error_code ec) {
+                    if (ec) {
+                        return;
+                    }
+                    lag.store(metrics::elapsed_microseconds(timer.expiry()), std::memory_order_relaxed);
+                    schedule();
+                    });
+        }
+
+        boost::asio::steady_timer timer;
+        const int64_t max_lag;
+        std::atomic<int64_t> lag;
+};
+
+constexpr int load_monitor::INTERVAL_MILLISECONDS;
+
+// Pairs players asking for a match. Players wait by rating bucket and one
+// joining a bucket where someone waits is matched at once, so a bucket holds
+// at most one player and joins and leaves take constant time however many
+// clients ask. Rooms are named so worker owns them. Members run on strand.
+class lobby {
+    public:
+        static constexpr int NUM_BUCKETS = 256;
+
+        lobby(boost::asio::io_context& io_context, metrics& stats, int worker = 0, int workers = 1):
+            strand(boost::asio::make_strand(io_context)), stats(stats),
+            // rooms of earlier runs may have been restored, names start with the start time
+            prefix("@" + std::to_string(std::chrono::system_clock::now().time_since_epoch().count()) + "-"), matches(0),
+            worker(worker), workers(workers) {}
+
+        void join(int bucket, const std::shared_ptr<subscriber>& s) {
+            boost::asio::post(strand, [this, bucket, s]() {
+                    std::shared_ptr<subscriber>& waiting = buckets[bucket];
+                    if (!waiting) {
+                        waiting = s;
+                        stats.add(metrics::WAITING);
+                        return;
+                    }
+                    std::string name;
+                    do {
+                        name = prefix + std::to_string(matches++);
+                    } while (room_owner(name, workers) != worker);
+                    waiting->matched(name, 0, bucket, s);
+                    s->matched(name, 1, bucket, waiting);
+                    waiting.reset();
+                    stats.add(metrics::WAITING, -1);
+                    stats.add(metrics::MATCHES);
+                    });
+        }
+
+        // stop waiting, unless already matched
+        void leave(int bucket, const std::shared_ptr<subscriber>& s) {
+            boost::asio::post(strand, [this, bucket, s]() {
+                    if (buckets[bucket] == s) {
+                        buckets[bucket].reset();
+                        stats.add(metrics::WAITING, -1);
+                    }
+                    });
+        }
+    private:
+        strand_type strand;
+        metrics& stats;
+        const std::string prefix;
+        uint64_t matches;
+        const int worker;
+        const int workers;
+        std::shared_ptr<subscriber> buckets[NUM_BUCKETS];
+};
+
+// where and how often rooms are persisted, no persistence without a path
+struct persistence_options {
+    std::string path;
+    int interval_milliseconds = 1000;
+    // restored rooms are kept this long for their players to log in again
+    int grace_seconds = 60;
+};
+
+// Writes every room to a room store periodically and once more when the
+// server stops, so a restarted server continues the games. Each room records
+// itself on its strand, the last one to finish writes the file. Members run
+// on strand.
+class room_persistence {
+    public:
+        room_persistence(boost::asio::io_context& io_context, room_manager& manager, const persistence_options& options):
+            io_context(io_context), manager(manager), store(options.path), strand(boost::asio::make_strand(io_context)),
+            timer(strand), hold(strand), interval(options.interval_milliseconds), saving(false), stopping(false) {
+            restore(options.grace_seconds);
+            schedule();
+        }
+
+        // save once more, then stop io_context
+        void stop() {
+            boost::asio::post(strand, [this]() {
+                    stopping = true;
+                    if (!saving) {
+                        timer.cancel();
+                        save();
+                    }
+                    });
+        }
+    private:
+        // records of one save, filled from the room strands
+        struct batch: public lockable {
+            std::string records;
+            uint32_t count = 0;
+            size_t pending = 0;
+        };
+
+        // recreate the rooms of the store, called before the server runs
+        void restore(int grace_seconds) {
+            const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            std::vector<room_record> records;
+            if (!store.load(records)) {
+                return;
+            }
+            for (const room_record& record: records) {
+                std::shared_ptr<room> r = manager.get(record.name);
+                r->restore(record);
+                held.push_back(r);
             }
-            room* ret = &_m[room_name];
-            unlock();
-            return ret;
+            std::cout << "Restored " << held.size() << " rooms in " << metrics::elapsed_microseconds(start) / 1000.0
+                << " milliseconds\n";
+            hold.expires_after(std::chrono::seconds(grace_seconds));
+            hold.async_wait([this](boost::system::error_code) {
+                    held.clear();
+                    });
         }
 
-        void remove(std::string& room_name) {
+        void schedule() {
+            timer.expires_after(std::chrono::milliseconds(interval));
+            timer.async_wait([this](boost::system::error_code ec) {
+                    if (!ec) {
+                        save();
+                    }
+                    });
+        }
+
+        void save() {
+            saving = true;
+            std::shared_ptr<batch> b = std::make_shared<batch>();
+            std::vector<std::shared_ptr<room> > rooms = manager.live_rooms();
+            b->pending = rooms.size();
+            if (rooms.empty()) {
+                saved(b);
+                return;
+            }
+            for (std::shared_ptr<room>& r: rooms) {
+                boost::asio::post(r->strand, [this, b, r]() {
+                        room_record record;
+                        r->record(record);
+                        b->lock();
+                        record.encode(b->records);
+                        b->count++;
+                        const bool last = --b->pending == 0;
+                        b->unlock();
+                        if (last) {
+                            boost::asio::post(strand, [this, b]() {
+                                    saved(b);
+                                    });
+                        }
+                        });
+            }
+        }
+
+        void saved(const std::shared_ptr<batch>& b) {
+            if (!store.save(b->records, b->count)) {
+                std::cerr << "Failed to save rooms\n";
+            }
+            saving = false;
+            if (stopping) {
+                io_context.stop();
+            } else {
+                schedule();
+            }
+        }
+
+        boost::asio::io_context& io_context;
+        room_manager& manager;
+        room_store store;
+        strand_type strand;
+        boost::asio::steady_timer timer;
+        boost::asio::steady_timer hold;
+        const int interval;
+        bool saving;
+        bool stopping;
+        std::vector<std::shared_ptr<room> > held;
+};
+
+#ifdef USE_IO_URING
+// Read buffers registered with the ring once, so reads into them are fixed
+// buffer reads that skip mapping the pages on every call. Registered memory
+// is pinned, sessions beyond the first REGISTERED read into their own buffer.
+class read_buffers: public lockable {
+    public:
+        static constexpr int LENGTH = 4096;
+        static constexpr int REGISTERED = 1024;
+
+        explicit read_buffers(boost::asio::io_context& io_context):
+            memory(new char[REGISTERED * LENGTH]), registration(boost::asio::register_buffers(io_context, slices())) {
+            for (int i = REGISTERED - 1; i >= 0; i--) {
+                free_slots.push_back(i);
+            }
+        }
+
+        // index of a free buffer, -1 when all are taken
+        int acquire() {
+            int slot = -1;
             ATOMIC_RUN(
-                    if (_m.find(room_name) != _m.end() && _m[room_name].need_clear()) {
-                        _m.erase(room_name);
+                    if (!free_slots.empty()) {
+                        slot = free_slots.back();
+                        free_slots.pop_back();
                     }
                     )
+            return slot;
+        }
+
+        void release(int slot) {
+            ATOMIC_RUN(free_slots.push_back(slot);)
+        }
+
+        char* data(int slot) {
+            return memory.get() + slot * LENGTH;
+        }
+
+        const boost::asio::mutable_registered_buffer& registered(int slot) {
+            return registration[slot];
         }
     private:
-        std::unordered_map<std::string, room> _m;
-} manager;
+        std::vector<boost::asio::mutable_buffer> slices() {
+            std::vector<boost::asio::mutable_buffer> buffers;
+            for (int i = 0; i < REGISTERED; i++) {
+                buffers.push_back(boost::asio::buffer(data(i), LENGTH));
+            }
+            return buffers;
+        }
+
+        std::unique_ptr<char[]> memory;
+        boost::asio::buffer_registration<std::vector<boost::asio::mutable_buffer>> registration;
+        std::vector<int> free_slots;
+};
 
-class session: public std::enable_shared_from_this<session> {
+constexpr int read_buffers::LENGTH;
+constexpr int read_buffers::REGISTERED;
+#endif
+
+// Client connection. Socket handlers run on the strand of the socket, room
+// calls are posted to the room strand and pushes come back through deliver.
+class session: public subscriber, public std::enable_shared_from_this<session> {
     public:
-        session(tcp::socket socket): socket_(std::move(socket)), logged_in(false) {}
+        session(strand_socket socket, room_manager& manager, lobby& matcher, metrics& stats, const limits& caps,
+                const load_monitor& load):
+            socket_(std::move(socket)), manager(manager), matcher(matcher), stats(stats), caps(caps), load(load), logged_in(false),
+            leaving(false), paused(false), bucket(-1), rematch(-1), writing(false), backlog(0) {
+            stats.add(metrics::SESSIONS);
+        }
+
+        ~session() {
+            stats.add(metrics::SESSIONS, -1);
+            if (logger) {
+                logger->debug("session {} closed", session_id);
+            }
+            if (capture && captured_any) {
+                // an empty frame ends the session in the capture
+                captured_message end{capture->now(), session_id, ""};
+                captured.clear();
+                end.encode(captured);
+                capture->append(captured);
+            }
+#ifdef USE_IO_URING
+            if (slot >= 0) {
+                registered_buffers->release(slot);
+            }
+#endif
+        }
+
+#ifdef USE_IO_URING
+        // read into a registered buffer while one is free
+        void use_buffers(read_buffers& pool) {
+            registered_buffers = &pool;
+            slot = pool.acquire();
+        }
+#endif
+
+        // capture every frame received as session id
+        void use_capture(traffic_capture& c, uint64_t id) {
+            capture = &c;
+            session_id = id;
+        }
+
+        // log logins, logouts and dropped clients as session id
+        void use_logger(async_logger& l, uint64_t id) {
+            logger = &l;
+            session_id = id;
+        }
+
+        // route every login and match to the worker owning its room
+        void use_handoff(connection_handoff& h) {
+            handoff = &h;
+        }
 
         void start() {
             do_read();
         }
+
+        // serve a connection handed over by another worker with the bytes it read
+        void start(const std::string& received) {
+            auto self(shared_from_this());
+            boost::asio::post(socket_.get_executor(), [this, self, received]() {
+                    handle_input(received.data(), received.length());
+                    });
+        }
+
+        void deliver(const std::string& keys, std::chrono::steady_clock::time_point put_time) {
+            auto self(shared_from_this());
+            boost::asio::post(socket_.get_executor(), make_custom_alloc_handler(push_memory, [this, self, keys, put_time]() {
+                    if (!logged_in) {
+                        return;
+                    }
+                    send_keys(keys);
+                    if (over_backlog()) {
+                        return;
+                    }
+                    // latency until queued for writing to this player
+                    const int64_t latency = metrics::elapsed_microseconds(put_time);
+                    for (size_t k = 0; k < keys.length(); k++) {
+                        stats.record_latency(latency);
+                    }
+                    if (room_) {
+                        room_->record_delivery(keys.length(), latency);
+                    }
+                    }));
+        }
+
+        void watch(const shared_frames& frames) {
+            auto self(shared_from_this());
+            boost::asio::post(socket_.get_executor(), make_custom_alloc_handler(push_memory, [this, self, frames]() {
+                    if (!logged_in) {
+                        return;
+                    }
+                    queue_outbox();
+                    shared_outbox.push_back(frames);
+                    backlog += frames->length();
+                    if (!over_backlog()) {
+                        flush();
+                    }
+                    }));
+        }
+
+        void matched(const std::string& room, int player, int bucket, const std::shared_ptr<subscriber>& opponent) {
+            auto self(shared_from_this());
+            boost::asio::post(socket_.get_executor(), [this, self, room, player, bucket, opponent]() {
+                    // left or asked again elsewhere meanwhile, the opponent looks for another
+                    if (this->bucket != bucket) {
+                        opponent->abandoned(room, bucket);
+                        return;
+                    }
+                    this->bucket = -1;
+                    if (logger) {
+                        logger->info("session {} matched in room {} as player {}", session_id, room, player);
+                    }
+                    const std::string payload = (char)(player + 1) + room;
+                    append_frame(outbox, commands::MATCH, payload.data(), payload.length());
+                    login(player, room);
+                    });
+        }
+
+        void abandoned(const std::string& room, int bucket) {
+            auto self(shared_from_this());
+            boost::asio::post(socket_.get_executor(), [this, self, room, bucket]() {
+                    // moved on already
+                    if (!room_ || room_->name != room) {
+                        return;
+                    }
+                    if (logger) {
+                        logger->info("session {} matched again, the opponent left room {} before taking its seat", session_id, room);
+                    }
+                    rematch = bucket;
+                    // a login in flight is answered first, so the client reads a whole MATCH reply
+                    if (logged_in) {
+                        requeue();
+                    }
+                    });
+        }
+
+        void dropped() {
+            auto self(shared_from_this());
+            boost::asio::post(socket_.get_executor(), [this, self]() {
+                    if (!logged_in) {
+                        return;
+                    }
+                    // the room logged the player out already
+                    logged_in = false;
+                    if (logger) {
+                        logger->warn("session {} dropped past {} keys in a turn of room {}", session_id, caps.max_turn_keys,
+                                room_->name);
+                    }
+                    room_.reset();
+                    boost::system::error_code ec;
+                    socket_.close(ec);
+                    });
+        }
     private:
         void do_read() {
             auto self(shared_from_this());
-            socket_.async_read_some(boost::asio::buffer(data_, MAX_LENGTH),
-                [this, self](boost::system::error_code ec, std::size_t length) {
+            char* input = data_;
+#ifdef USE_IO_URING
+            if (slot >= 0) {
+                input = registered_buffers->data(slot);
+            }
+#endif
+            auto received = make_custom_alloc_handler(read_memory,
+                [this, self, input](boost::system::error_code ec, std::size_t length) {
                     if (!ec) {
-                        if (length == 2 && this->data_[0] == commands::PUT) {
-                            if (logged_in) {
-                                manager.get(room_name)->put(this->data_[1]);
-                            }
-                            do_read();
-                        } else if (length == 1 && this->data_[0] == commands::GET) {
-                            if (logged_in) {
-                                if (!manager.get(room_name)->has_next()) {
-                                    data_[0] = CHAR_CONT;
-                                } else {
-                                    char c = manager.get(room_name)->get();
-                                    if (c >= 'a' && c <= 'z') {
-                                        c = KEY_MAP[c - 'a'];
-                                    }
-                                    data_[0] = c;
-                                }
-                                do_write(1);
-                            } else {
-                                do_read();
-                            }
-                        } else if (length > 1 && this->data_[0] == commands::IN) {
-                            if (!this->logged_in) {
-                                player = (int)this->data_[1] - 1;
-                                if (length > MAX_LENGTH) {
-                                    data_[MAX_LENGTH] = '\0';
-                                } else {
-                                    data_[length] = '\0';
-                                }
-                                room_name += (data_ + 2);
-                                if (manager.get(room_name)->player_login(player)) {
-                                    this->logged_in = true;
-                                    data_[0] = success_fail::SUCCESS;
-                                } else {
-                                    data_[0] = success_fail::FAIL;
-                                }
-                            } else {
-                                data_[0] = success_fail::FAIL;
-                            }
-                            do_write(1);
+                        stats.add(metrics::BYTES_IN, length);
+                        handle_input(input, length);
+                        return;
+                    }
+                    leave();
+                });
+#ifdef USE_IO_URING
+            if (slot >= 0) {
+                socket_.async_read_some(registered_buffers->registered(slot), received);
+                return;
+            }
+#endif
+            socket_.async_read_some(boost::asio::buffer(data_, READ_LENGTH), received);
+        }
+
+        void handle_input(const char* input, size_t length) {
+            reader.feed(input, length);
+            const bool ok = handle_frames();
+            if (capture && !captured.empty()) {
+                capture->append(captured);
+                captured.clear();
+            }
+            if (ok && handoff_to >= 0) {
+                hand_off();
+                return;
+            }
+            if (ok) {
+                read_more();
+                return;
+            }
+            if (logger) {
+                logger->warn("session {} closed on an invalid frame", session_id);
+            }
+            boost::system::error_code ec;
+            socket_.close(ec);
+            leave();
+        }
+
+        // True if a login or match of an idle session belongs to another
+        // worker. The frame and the bytes after it are kept for the owner.
+        bool owned_elsewhere(char command, const char* payload, size_t length) {
+            if (!handoff) {
+                return false;
+            }
+            const int owner = frame_owner(command, payload, length, handoff->get_worker(), handoff->get_workers());
+            if (owner == handoff->get_worker()) {
+                return false;
+            }
+            handoff_to = owner;
+            unrouted = reader.from_last();
+            return true;
+        }
+
+        // pass the connection to handoff_to once every reply is written, so the owner's replies follow them
+        void hand_off() {
+            if (writing || !outbox.empty() || !shared_outbox.empty()) {
+                return;
+            }
+            // the owner gets its own descriptor, this one is closed with the session
+            const bool sent = handoff->send(handoff_to, socket_.native_handle(), unrouted);
+            stats.add(sent ? metrics::HANDED_OFF : metrics::REJECTED);
+            if (logger) {
+                logger->debug("session {} {} worker {}", session_id, sent ? "handed off to" : "dropped, no room on the link to",
+                        handoff_to);
+            }
+            boost::system::error_code ec;
+            socket_.close(ec);
+        }
+
+        // read on unless much is queued for the client, writes resume reading once it drains
+        void read_more() {
+            if (queued() > caps.max_backlog / 4) {
+                paused = true;
+                return;
+            }
+            do_read();
+        }
+
+        // bytes queued for the client and not being written yet
+        size_t queued() const {
+            return outbox.length() + backlog;
+        }
+
+        // drop a client too slow to read what is queued for it, a new login starts from a snapshot
+        bool over_backlog() {
+            if (queued() <= caps.max_backlog) {
+                return false;
+            }
+            stats.add(metrics::SLOW_DROPPED);
+            if (logger) {
+                logger->warn("session {} dropped with {} bytes queued", session_id, queued());
+            }
+            boost::system::error_code ec;
+            socket_.close(ec);
+            leave();
+            return true;
+        }
+
+        // handle every whole frame received, return false on a protocol error
+        bool handle_frames() {
+            char command;
+            const char* payload;
+            size_t length;
+            std::string& keys = incoming;
+            while (reader.next(command, payload, length)) {
+                if (capture) {
+                    capture_frame(command, payload, length);
+                }
+                if (command == commands::PUT && length == 1) {
+                    keys += payload[0];
+                    continue;
+                }
+                put(keys);
+                if ((command == commands::IN || command == commands::MATCH) && !room_ && bucket < 0 &&
+                        owned_elsewhere(command, payload, length)) {
+                    // later frames are the owner's
+                    return true;
+                }
+                if (command == commands::IN && length >= 1 && length <= MAX_ROOM_NAME_LENGTH + 1) {
+                    stats.add(metrics::IN_MESSAGES);
+                    if (room_ || bucket >= 0) {
+                        reply(success_fail::FAIL);
+                    } else if (load.saturated()) {
+                        // shed new players first, those in a game keep being served
+                        stats.add(metrics::SHED_LOGINS);
+                        if (logger) {
+                            logger->warn("session {} login shed under load", session_id);
                         }
+                        reply(success_fail::FAIL);
                     } else {
-                        if (this->logged_in) {
-                            this->logged_in = false;
-                            manager.get(room_name)->player_logout(player);
-                            manager.remove(room_name);
+                        login((int)payload[0] - 1, std::string(payload + 1, length - 1));
+                    }
+                } else if (command == commands::MATCH && length <= 1) {
+                    stats.add(metrics::MATCH_MESSAGES);
+                    if (room_ || bucket >= 0) {
+                        reply(success_fail::FAIL);
+                    } else if (load.saturated()) {
+                        stats.add(metrics::SHED_LOGINS);
+                        if (logger) {
+                            logger->warn("session {} login shed under load", session_id);
                         }
+                        reply(success_fail::FAIL);
+                    } else {
+                        bucket = length == 1 ? (unsigned char)payload[0] : 0;
+                        matcher.join(bucket, shared_from_this());
                     }
-                });
+                } else if (command == commands::OUT && length == 0) {
+                    stats.add(metrics::OUT_MESSAGES);
+                    leave();
+                } else {
+                    stats.add(metrics::BAD_MESSAGES);
+                    return false;
+                }
+            }
+            put(keys);
+            if (reader.is_malformed()) {
+                stats.add(metrics::BAD_MESSAGES);
+                return false;
+            }
+            return true;
+        }
+
+        // queue a frame for the capture, written once the read is handled
+        void capture_frame(char command, const char* payload, size_t length) {
+            captured_message message{capture->now(), session_id, ""};
+            append_frame(message.frame, command, payload, length);
+            message.encode(captured);
+            captured_any = true;
+        }
+
+        // forward keys in one message to the room, in order after a login in flight
+        void put(std::string& keys) {
+            stats.add(metrics::PUT_MESSAGES, keys.length());
+            if (room_ && player != SPECTATOR && !keys.empty()) {
+                // the session outlives the handler, its memory is given back after the call
+                auto self(shared_from_this());
+                std::shared_ptr<room> r = room_;
+                const int p = player;
+                const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+                boost::asio::post(r->strand, make_custom_alloc_handler(put_memory, [self, r, p, keys, now]() {
+                        shared_frames frames = r->put(self.get(), p, keys, now);
+                        if (frames) {
+                            boost::asio::post(r->audience, make_custom_alloc_handler(r->broadcast_memory, [r, frames]() {
+                                    r->broadcast(frames);
+                                    }));
+                        }
+                        }));
+            }
+            keys.clear();
+        }
+
+        // log in on the room strand, reply with a snapshot of the game on the socket strand
+        void login(int player, const std::string& name) {
+            auto self(shared_from_this());
+            this->player = player;
+            room_ = manager.get(name);
+            if (logger) {
+                logger->info("session {} logs in to room {} as player {}", session_id, name, player);
+            }
+            std::shared_ptr<room> r = room_;
+            if (player == SPECTATOR) {
+                spectate(r);
+                return;
+            }
+            boost::asio::post(r->strand, [this, self, r, player]() {
+                    snapshot_message snap;
+                    std::string keys;
+                    const bool ok = r->player_login(player, this, snap, keys);
+                    boost::asio::post(socket_.get_executor(), [this, self, ok, snap, keys]() {
+                            joined(ok, snap, keys);
+                            });
+                    });
         }
 
-        void do_write(std::size_t length) {
+        // snapshot on the room strand, join the audience, then reply on the socket strand
+        void spectate(const std::shared_ptr<room>& r) {
             auto self(shared_from_this());
-            boost::asio::async_write(socket_, boost::asio::buffer(data_, length),
-                [this, self](boost::system::error_code ec, std::size_t /*length*/) {
+            boost::asio::post(r->strand, [this, self, r]() {
+                    snapshot_message snap;
+                    std::string keys;
+                    r->spectator_snapshot(snap, keys);
+                    boost::asio::post(r->audience, [this, self, r, snap, keys]() {
+                            r->spectator_login(this);
+                            boost::asio::post(socket_.get_executor(), [this, self, snap, keys]() {
+                                    stats.add(metrics::SPECTATORS);
+                                    joined(true, snap, keys);
+                                    });
+                            });
+                    });
+        }
+
+        void joined(bool ok, const snapshot_message& snap, const std::string& keys) {
+            if (ok) {
+                logged_in = true;
+                if (leaving) {
+                    leave();
+                    return;
+                }
+                reply(success_fail::SUCCESS);
+                const std::string payload = snap.encode();
+                append_frame(outbox, commands::SNAPSHOT, payload.data(), payload.length());
+                send_keys(keys);
+                if (rematch >= 0) {
+                    requeue();
+                }
+            } else {
+                if (logger) {
+                    logger->info("session {} refused, seat {} of room {} taken", session_id, player, room_->name);
+                }
+                reply(success_fail::FAIL);
+                room_.reset();
+                rematch = -1;
+            }
+        }
+
+        void reply(char result) {
+            append_frame(outbox, result);
+            flush();
+        }
+
+        void send_keys(const std::string& keys) {
+            for (char c: keys) {
+                append_frame(outbox, commands::PUT, &c, 1);
+            }
+            flush();
+        }
+
+        // write queued frames in one write as soon as previous writes complete
+        void flush() {
+            if (!writing && (!outbox.empty() || !shared_outbox.empty())) {
+                do_write();
+            }
+        }
+
+        // move frames of this session behind the shared frames to keep them in order
+        void queue_outbox() {
+            if (!outbox.empty()) {
+                backlog += outbox.length();
+                shared_outbox.push_back(std::allocate_shared<const std::string>(pool_allocator<std::string>(), std::move(outbox)));
+                outbox.clear();
+            }
+        }
+
+        void do_write() {
+            auto self(shared_from_this());
+            writing = true;
+            auto written = make_custom_alloc_handler(write_memory, [this, self](boost::system::error_code ec, std::size_t length) {
+                    writing = false;
+                    shared_writing.clear();
+                    stats.add(metrics::BYTES_OUT, length);
+                    if (!ec && handoff_to >= 0) {
+                        flush();
+                        hand_off();
+                        return;
+                    }
                     if (!ec) {
-                        do_read();
-                    } else {
-                        if (this->logged_in) {
-                            this->logged_in = false;
-                            manager.get(room_name)->player_logout(player);
-                            manager.remove(room_name);
+                        flush();
+                        if (paused && queued() <= caps.max_backlog / 4) {
+                            paused = false;
+                            do_read();
                         }
+                    } else {
+                        leave();
                     }
                 });
+            if (shared_outbox.empty()) {
+                write_buffer.swap(outbox);
+                outbox.clear();
+                boost::asio::async_write(socket_, boost::asio::buffer(write_buffer), written);
+                return;
+            }
+            // gather the shared buffers, nothing is copied per spectator
+            queue_outbox();
+            shared_writing.swap(shared_outbox);
+            backlog = 0;
+            buffers.clear();
+            for (const shared_frames& frames: shared_writing) {
+                buffers.push_back(boost::asio::buffer(*frames));
+            }
+            boost::asio::async_write(socket_, buffers, written);
+        }
+
+        // leave the room of an opponent that never took its seat and wait in the lobby again
+        void requeue() {
+            const int again = rematch;
+            leave();
+            bucket = again;
+            matcher.join(bucket, shared_from_this());
         }
 
-        tcp::socket socket_;
+        void leave() {
+            rematch = -1;
+            if (bucket >= 0) {
+                matcher.leave(bucket, shared_from_this());
+                bucket = -1;
+            }
+            // login in flight, leave once it completes
+            leaving = !this->logged_in && room_;
+            if (this->logged_in) {
+                this->logged_in = false;
+                if (logger) {
+                    logger->info("session {} left room {}", session_id, room_->name);
+                }
+                // the room refers to this session until the logout runs
+                auto self(shared_from_this());
+                std::shared_ptr<room> r = std::move(room_);
+                const int p = player;
+                if (p == SPECTATOR) {
+                    stats.add(metrics::SPECTATORS, -1);
+                    boost::asio::post(r->audience, [self, r]() {
+                            r->spectator_logout(self.get());
+                            });
+                    return;
+                }
+                boost::asio::post(r->strand, [self, r, p]() {
+                        r->player_logout(p, self.get());
+                        });
+            }
+        }
+
+        strand_socket socket_;
+        room_manager& manager;
+        lobby& matcher;
+        metrics& stats;
+        const limits& caps;
+        const load_monitor& load;
         bool logged_in;
+        bool leaving;
+        // reading stopped until queued frames are written
+        bool paused;
         int player;
-        std::string room_name;
-        static constexpr int MAX_LENGTH = MAX_ROOM_NAME_LENGTH + 2;
-        char data_[MAX_LENGTH + 1];
+        // rating bucket while waiting in the lobby, -1 otherwise
+        int bucket;
+        // bucket to wait in again once seated in an abandoned match, -1 otherwise
+        int rematch;
+        std::shared_ptr<room> room_;
+        static constexpr int READ_LENGTH = 4096;
+        char data_[READ_LENGTH];
+        frame_reader reader;
+        bool writing;
+        std::string outbox;
+        std::string write_buffer;
+        // spectators queue shared frames, backlog counts their bytes
+        std::vector<shared_frames> shared_outbox;
+        std::vector<shared_frames> shared_writing;
+        std::vector<boost::asio::const_buffer> buffers;
+        size_t backlog;
+        // keys of the frames read last, kept to reuse its buffer
+        std::string incoming;
+        // null unless serving as one of several workers
+        connection_handoff* handoff = nullptr;
+        // worker the connection is passed to once written out, -1 if none, and the bytes it gets
+        int handoff_to = -1;
+        std::string unrouted;
+        traffic_capture* capture = nullptr;
+        async_logger* logger = nullptr;
+        uint64_t session_id = 0;
+        bool captured_any = false;
+        std::string captured;
+        // one per kind of operation, a second one in flight uses the heap
+        handler_memory read_memory;
+        handler_memory write_memory;
+        handler_memory push_memory;
+        handler_memory put_memory;
+#ifdef USE_IO_URING
+        read_buffers* registered_buffers = nullptr;
+        int slot = -1;
+#endif
 };
 
-class server {
+// Local admin endpoint, answers any request with the metrics in Prometheus
+// text format and closes the connection.
+class admin_server {
     public:
-        server(boost::asio::io_context& io_context, short port): acceptor_(io_context, tcp::endpoint(tcp::v4(), port)) {
+        admin_server(boost::asio::io_context& io_context, short port, metrics& stats, room_manager& manager, const load_monitor& load):
+            acceptor_(io_context, tcp::endpoint(boost::asio::ip::address_v4::loopback(), port)), stats(stats), manager(manager),
+            load(load) {
             do_accept();
         }
     private:
+        static constexpr int MAX_HOT_ROOMS = 10;
+
+        struct request {
+            request(tcp::socket socket): socket(std::move(socket)) {}
+
+            tcp::socket socket;
+            char data[1024];
+            std::string response;
+        };
+
         void do_accept() {
             acceptor_.async_accept(
                 [this](boost::system::error_code ec, tcp::socket socket) {
                     if (!ec) {
-                        std::make_shared<session>(std::move(socket))->start();
+                        std::shared_ptr<request> req = std::make_shared<request>(std::move(socket));
+                        req->socket.async_read_some(boost::asio::buffer(req->data),
+                            [this, req](boost::system::error_code ec, std::size_t) {
+                                if (ec) {
+                                    return;
+                                }
+                                const std::string body = report();
+                                req->response = "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n"
+                                    "Content-Length: " + std::to_string(body.length()) + "\r\n\r\n" + body;
+                                boost::asio::async_write(req->socket, boost::asio::buffer(req->response),
+                                    [req](boost::system::error_code, std::size_t) {});
+                            });
                     }
 
                     do_accept();
                 });
         }
 
+        std::string report() {
+            std::string out;
+            counter(out, "cc_connections_accepted_total", "counter", stats.get(metrics::ACCEPTED));
+            counter(out, "cc_connections_rejected_total", "counter", stats.get(metrics::REJECTED));
+            counter(out, "cc_connections_handed_off_total", "counter", stats.get(metrics::HANDED_OFF));
+            counter(out, "cc_sessions_active", "gauge", stats.get(metrics::SESSIONS));
+            counter(out, "cc_rooms_active", "gauge", stats.get(metrics::ROOMS));
+            counter(out, "cc_spectators_active", "gauge", stats.get(metrics::SPECTATORS));
+            counter(out, "cc_slow_clients_dropped_total", "counter", stats.get(metrics::SLOW_DROPPED));
+            counter(out, "cc_logins_shed_total", "counter", stats.get(metrics::SHED_LOGINS));
+            counter(out, "cc_turn_limit_dropped_total", "counter", stats.get(metrics::TURN_DROPPED));
+            counter(out, "cc_matches_total", "counter", stats.get(metrics::MATCHES));
+            counter(out, "cc_lobby_waiting", "gauge", stats.get(metrics::WAITING));
+            counter(out, "cc_event_loop_lag_microseconds", "gauge", load.get_lag_microseconds());
+            out += "# TYPE cc_messages_total counter\n";
+            out += "cc_messages_total{command=\"put\"} " + std::to_string(stats.get(metrics::PUT_MESSAGES)) + "\n";
+            out += "cc_messages_total{command=\"in\"} " + std::to_string(stats.get(metrics::IN_MESSAGES)) + "\n";
+            out += "cc_messages_total{command=\"out\"} " + std::to_string(stats.get(metrics::OUT_MESSAGES)) + "\n";
+            out += "cc_messages_total{command=\"match\"} " + std::to_string(stats.get(metrics::MATCH_MESSAGES)) + "\n";
+            out += "cc_messages_total{command=\"invalid\"} " + std::to_string(stats.get(metrics::BAD_MESSAGES)) + "\n";
+            counter(out, "cc_bytes_received_total", "counter", stats.get(metrics::BYTES_IN));
+            counter(out, "cc_bytes_sent_total", "counter", stats.get(metrics::BYTES_OUT));
+            out += stats.format_latency("cc_delivery_latency_microseconds");
+#ifdef COUNT_ALLOCATIONS
+            counter(out, "cc_heap_allocations_total", "counter", heap_allocations.load(std::memory_order_relaxed));
+#endif
+
+            // rooms with the most delivered keys
+            std::vector<std::pair<int64_t, std::pair<std::string, int64_t> > > rooms;
+            manager.for_each([&rooms](const room& r) {
+                    rooms.push_back({r.get_messages(), {r.name, r.get_latency_sum()}});
+                    });
+            const int hot = std::min((int)rooms.size(), MAX_HOT_ROOMS);
+            std::partial_sort(rooms.begin(), rooms.begin() + hot, rooms.end(),
+                    [](const decltype(rooms)::value_type& a, const decltype(rooms)::value_type& b) { return a.first > b.first; });
+            out += "# TYPE cc_room_messages_total counter\n";
+            for (int k = 0; k < hot; k++) {
+                out += "cc_room_messages_total{room=\"" + escape(rooms[k].second.first) + "\"} " + std::to_string(rooms[k].first) + "\n";
+            }
+            out += "# TYPE cc_room_delivery_latency_microseconds_sum counter\n";
+            for (int k = 0; k < hot; k++) {
+                out += "cc_room_delivery_latency_microseconds_sum{room=\"" + escape(rooms[k].second.first) + "\"} " +
+                    std::to_string(rooms[k].second.second) + "\n";
+            }
+            return out;
+        }
+
+        static void counter(std::string& out, const std::string& name, const std::string& type, int64_t value) {
+            out += "# TYPE " + name + " " + type + "\n" + name + " " + std::to_string(value) + "\n";
+        }
+
+        // room name as a label value
+        static std::string escape(const std::string& name) {
+            std::string out;
+            for (char c: name) {
+                if (c == '\\' || c == '"') {
+                    out += '\\';
+                    out += c;
+                } else if (c == '\n') {
+                    out += "\\n";
+                } else {
+                    out += c;
+                }
+            }
+            return out;
+        }
+
         tcp::acceptor acceptor_;
+        metrics& stats;
+        room_manager& manager;
+        const load_monitor& load;
 };
 
-int main(int argc, char* argv[]) {
-    try {
-        if (argc != 2) {
-            std::cerr << "Usage: " << argv[0] << " <port>\n";
-            return 1;
+constexpr int admin_server::MAX_HOT_ROOMS;
+
+// one of the processes serving a port, linked to the others
+struct worker_options {
+    int worker = 0;
+    // link to every worker, -1 for this one, none when serving alone
+    std::vector<int> links;
+
+    int workers() const {
+        return std::max(1, (int)links.size());
+    }
+};
+
+// SO_REUSEPORT, which Asio has no public option for
+class reuse_port {
+    public:
+        explicit reuse_port(bool enabled): value(enabled ? 1 : 0) {}
+
+        template <typename Protocol>
+        int level(const Protocol&) const {
+            return SOL_SOCKET;
         }
 
-        std::cout << "Server started\n";
+        template <typename Protocol>
+        int name(const Protocol&) const {
+            return SO_REUSEPORT;
+        }
+
+        template <typename Protocol>
+        const int* data(const Protocol&) const {
+            return &value;
+        }
 
+        template <typename Protocol>
+        std::size_t size(const Protocol&) const {
+            return sizeof(value);
+        }
+    private:
+        int value;
+};
+
+class server {
+    public:
+        server(int threads, short port, short admin_port, const limits& caps, const persistence_options& persistence,
+                const event_log_options& events, const worker_options& cluster, const std::string& capture_path,
+                const std::string& local_path, const std::string& log_path, int log_level):
+            caps(caps), logger(log_path.empty() ? nullptr : new async_logger(log_path, log_level)),
+            log(events.directory.empty() ? nullptr : new event_log(events)),
+            capture(capture_path.empty() ? nullptr : new traffic_capture(capture_path)), next_session(0),
+            manager(io_context, caps, stats, log.get()), io_context(threads),
+            matcher(io_context, stats, cluster.worker, cluster.workers()), load(io_context, caps.max_lag_milliseconds),
+            acceptor_(io_context), signals(io_context, SIGINT, SIGTERM)
+#ifdef USE_IO_URING
+            , buffers(io_context)
+#endif
+        {
+            // workers share the port, the kernel spreads connections over them
+            const stream_endpoint endpoint = tcp::endpoint(tcp::v4(), port);
+            acceptor_.open(endpoint.protocol());
+            acceptor_.set_option(stream_acceptor::reuse_address(true));
+            if (cluster.workers() > 1) {
+                acceptor_.set_option(reuse_port(true));
+                handoff.reset(new connection_handoff(io_context, cluster.worker, cluster.links,
+                            [this](int fd, const std::string& received) {
+                            adopt(fd, received);
+                            }));
+            }
+            acceptor_.bind(endpoint);
+            acceptor_.listen();
+            // clients on this host, handed to the owner of their room like any other
+            if (!local_path.empty() && cluster.worker == 0) {
+                ::unlink(local_path.c_str());
+                local_acceptor.reset(new stream_acceptor(io_context, stream_endpoint(boost::asio::local::stream_protocol::endpoint(local_path))));
+                this->local_path = local_path;
+            }
+            if (admin_port) {
+                admin.reset(new admin_server(io_context, admin_port, stats, manager, load));
+            }
+            if (!persistence.path.empty()) {
+                keeper.reset(new room_persistence(io_context, manager, persistence));
+            }
+            // stop cleanly so the last rooms and events reach the disk
+            signals.async_wait([this](boost::system::error_code ec, int) {
+                    if (ec) {
+                        return;
+                    }
+                    if (keeper) {
+                        keeper->stop();
+                    } else {
+                        io_context.stop();
+                    }
+                    });
+            do_accept(acceptor_);
+            if (local_acceptor) {
+                do_accept(*local_acceptor);
+            }
+        }
+
+        ~server() {
+            if (!local_path.empty()) {
+                ::unlink(local_path.c_str());
+            }
+        }
+
+        // serve on threads until stopped
+        void run(int threads) {
+            std::vector<std::thread> workers;
+            for (int t = 1; t < threads; t++) {
+                workers.emplace_back([this]() { io_context.run(); });
+            }
+            io_context.run();
+            for (std::thread& worker: workers) {
+                worker.join();
+            }
+        }
+    private:
+        void do_accept(stream_acceptor& acceptor) {
+            // each session gets its own strand
+            acceptor.async_accept(boost::asio::make_strand(io_context),
+                [this, &acceptor](boost::system::error_code ec, strand_socket socket) {
+                    if (!ec) {
+                        stats.add(metrics::ACCEPTED);
+                        // closed at once past the cap rather than left waiting in the backlog
+                        if (stats.get(metrics::SESSIONS) >= caps.max_connections) {
+                            stats.add(metrics::REJECTED);
+                            if (logger) {
+                                logger->warn("connection refused past {} connections", caps.max_connections);
+                            }
+                        } else {
+                            std::shared_ptr<session> s = make_session(std::move(socket));
+                            if (handoff) {
+                                s->use_handoff(*handoff);
+                            }
+                            s->start();
+                        }
+                    } else if (logger) {
+                        logger->error("accept failed: {}", ec.message());
+                    }
+
+                    do_accept(acceptor);
+                });
+        }
+
+        // serve a connection another worker accepted
+        void adopt(int fd, const std::string& received) {
+            strand_socket socket(boost::asio::make_strand(io_context));
+            // the connection came over TCP or a Unix domain socket
+            sockaddr_storage address;
+            socklen_t length = sizeof(address);
+            boost::system::error_code ec;
+            if (getsockname(fd, (sockaddr*)&address, &length) != 0) {
+                ::close(fd);
+                return;
+            }
+            const int family = address.ss_family;
+            socket.assign(boost::asio::generic::stream_protocol(family, family == AF_UNIX ? 0 : (int)IPPROTO_TCP), fd, ec);
+            if (ec) {
+                ::close(fd);
+                return;
+            }
+            if (stats.get(metrics::SESSIONS) >= caps.max_connections) {
+                stats.add(metrics::REJECTED);
+                return;
+            }
+            std::shared_ptr<session> s = make_session(std::move(socket));
+            // it may log in to a room of another worker later
+            s->use_handoff(*handoff);
+            s->start(received);
+        }
+
+        std::shared_ptr<session> make_session(strand_socket socket) {
+            std::shared_ptr<session> s = std::allocate_shared<session>(pool_allocator<session>(),
+                    std::move(socket), manager, matcher, stats, caps, load);
+            if (capture || logger) {
+                const uint64_t id = next_session.fetch_add(1, std::memory_order_relaxed);
+                if (capture) {
+                    s->use_capture(*capture, id);
+                }
+                if (logger) {
+                    s->use_logger(*logger, id);
+                    logger->debug("session {} connected", id);
+                }
+            }
+#ifdef USE_IO_URING
+            s->use_buffers(buffers);
+#endif
+            return s;
+        }
+
+        const limits& caps;
+        // sessions and rooms left when the server stops are released with io_context, after the members above it
+        metrics stats;
+        std::unique_ptr<async_logger> logger;
+        std::unique_ptr<event_log> log;
+        std::unique_ptr<traffic_capture> capture;
+        std::atomic<uint64_t> next_session;
+        room_manager manager;
         boost::asio::io_context io_context;
+        lobby matcher;
+        load_monitor load;
+        stream_acceptor acceptor_;
+        std::unique_ptr<stream_acceptor> local_acceptor;
+        std::string local_path;
+        boost::asio::signal_set signals;
+        std::unique_ptr<admin_server> admin;
+        std::unique_ptr<room_persistence> keeper;
+        std::unique_ptr<connection_handoff> handoff;
+#ifdef USE_IO_URING
+        read_buffers buffers;
+#endif
+};
 
-        server s(io_context, std::atoi(argv[1]));
+int main(int argc, char* argv[]) {
+    const char* usage = " [-t threads] [-a admin port] [-c max connections] [-k max turn keys] [-b max backlog bytes]"
+        " [-l max lag milliseconds] [-s room snapshot file] [-i snapshot interval milliseconds] [-g grace seconds]"
+        " [-e event log directory] [-w worker processes] [-r capture file] [-u unix socket path] [-o log file, - for stderr]"
+        " [-v] <port>\n";
+    // threads default to one per core, also when given as 0
+    int threads = 0;
+    int admin_port = 0;
+    limits caps;
+    persistence_options persistence;
+    event_log_options events;
+    int workers = 1;
+    std::string capture_path;
+    std::string local_path;
+    std::string log_path;
+    int log_level = log_levels::INFO;
+    int opt;
+    while ((opt = getopt(argc, argv, "t:a:c:k:b:l:s:i:g:e:w:r:u:o:v")) != -1) {
+        switch (opt) {
+            case 't':
+                threads = std::atoi(optarg);
+                break;
+            case 'a':
+                admin_port = std::atoi(optarg);
+                break;
+            case 'c':
+                caps.max_connections = std::atoi(optarg);
+                break;
+            case 'k':
+                caps.max_turn_keys = std::min(std::atoi(optarg), 65535);
+                break;
+            case 'b':
+                caps.max_backlog = std::atoi(optarg);
+                break;
+            case 'l':
+                caps.max_lag_milliseconds = std::atoi(optarg);
+                break;
+            case 's':
+                persistence.path = optarg;
+                break;
+            case 'i':
+                persistence.interval_milliseconds = std::atoi(optarg);
+                break;
+            case 'g':
+                persistence.grace_seconds = std::atoi(optarg);
+                break;
+            case 'e':
+                events.directory = optarg;
+                break;
+            case 'w':
+                workers = std::max(1, std::atoi(optarg));
+                break;
+            case 'r':
+                capture_path = optarg;
+                break;
+            case 'u':
+                local_path = optarg;
+                break;
+            case 'o':
+                log_path = optarg;
+                break;
+            case 'v':
+                log_level = log_levels::DEBUG;
+                break;
+            default:
+                std::cerr << "Usage: " << argv[0] << usage;
+                return 1;
+        }
+    }
+    if (optind != argc - 1) {
+        std::cerr << "Usage: " << argv[0] << usage;
+        return 1;
+    }
+    if (threads <= 0) {
+        threads = std::max(1, (int)std::thread::hardware_concurrency() / workers);
+    }
+    // fork the workers before any thread starts, worker 0 stays in this process
+    worker_options cluster;
+    std::vector<pid_t> children;
+    if (workers > 1) {
+        worker_mesh mesh(workers);
+        for (int w = 1; w < workers && cluster.worker == 0; w++) {
+            const pid_t pid = fork();
+            if (pid == 0) {
+                cluster.worker = w;
+#ifdef __linux__
+                prctl(PR_SET_PDEATHSIG, SIGTERM);
+#endif
+                children.clear();
+            } else if (pid > 0) {
+                children.push_back(pid);
+            } else {
+                std::cerr << "Failed to start worker " << w << "\n";
+            }
+        }
+        cluster.links = mesh.keep(cluster.worker);
+        // every worker keeps its own rooms, events and metrics
+        const std::string suffix = "." + std::to_string(cluster.worker);
+        if (!persistence.path.empty()) {
+            persistence.path += suffix;
+        }
+        if (!events.directory.empty()) {
+            events.directory += suffix;
+        }
+        if (!capture_path.empty()) {
+            capture_path += suffix;
+        }
+        if (!log_path.empty() && log_path != "-") {
+            log_path += suffix;
+        }
+        if (admin_port) {
+            admin_port += cluster.worker;
+        }
+    }
+    try {
+#ifdef USE_IO_URING
+        std::cout << "Server started with " << threads << " threads on io_uring";
+#else
+        std::cout << "Server started with " << threads << " threads";
+#endif
+        if (workers > 1) {
+            std::cout << " as worker " << cluster.worker << " of " << workers;
+        }
+        std::cout << "\n";
 
-        io_context.run();
+        server s(threads, std::atoi(argv[optind]), admin_port, caps, persistence, events, cluster, capture_path, local_path, log_path,
+                log_level);
+        s.run(threads);
     } catch (std::exception& e) {
         std::cerr << "Exception: " << e.what() << "\n";
     }
+    // the other workers stop with the first one
+    for (pid_t pid: children) {
+        kill(pid, SIGTERM);
+    }
+    for (pid_t pid: children) {
+        waitpid(pid, nullptr, 0);
+    }
     std::cout << "Server stopped\n";
 
     return 0;
@@ -0,0 +1,499 @@
+#include <algorithm>  // sort, min
+#include <chrono>     // steady_clock
+#include <cstdint>    // uint8_t, uint64_t
+#include <cstdlib>    // atoi, rand, srand
+#include <cstring>    // memset, strcmp
+#include <fcntl.h>    // open
+#include <iostream>   // cout, cerr
+#include <memory>     // unique_ptr
+#include <string>     // string
+#include <sys/mman.h> // mmap, munmap
+#include <unistd.h>   // ftruncate, close, getopt
+#include <vector>     // vector
+
+#include "position.hpp"
+
+// Optimal solver for solo mode: minimum number of moves taking side 0 from
+// its start triangle into its goal triangle with no opponent on the board.
+
+// hop parity class of a hole, hops never change it
+inline int hole_class(int h) {
+    const position::geometry& g = position::geo();
+    const int a = (g.col[h] + g.row[h]) / 2;
+    const int b = (g.col[h] - g.row[h] + 2 * M) / 2;
+    return ((a & 1) << 1) | (b & 1);
+}
+
+constexpr int NUM_CLASS = 4;
+constexpr int NUM_GOAL = NUM_PIECE;
+constexpr uint8_t UNKNOWN = 0xff;
+
+// Pattern database over the abstraction (filled goal holes, number of pieces
+// outside the goal in each parity class). An abstract move lifts one piece and
+// drops it anywhere its concrete move could: hops keep the parity class,
+// single steps need an adjacent hole. Every concrete move maps to an abstract
+// move, so abstract distances never overestimate.
+class pattern_database {
+    public:
+        pattern_database(): distance(SIZE, UNKNOWN) {
+            const position::geometry& g = position::geo();
+            for (int k = 0; k < NUM_GOAL; k++) {
+                goal_class[k] = hole_class(k);
+                for (int c = 0; c < NUM_CLASS; c++) {
+                    step_outside[k][c] = false;
+                }
+                for (int l = 0; l < NUM_GOAL; l++) {
+                    step_goal[k][l] = false;
+                }
+                for (int d = 0; d < NUM_DIRECTION; d++) {
+                    if (g.ray_length[k][d] > 0) {
+                        const int h = g.ray[k][d][0];
+                        if (h < NUM_GOAL) {
+                            step_goal[k][h] = true;
+                        } else {
+                            step_outside[k][hole_class(h)] = true;
+                        }
+                    }
+                }
+            }
+            build();
+        }
+
+        // lower bound of moves left for side 0 of pos
+        int lookup(const position& pos) const {
+            int mask = 0;
+            int count[NUM_CLASS] = {0, 0, 0, 0};
+            const uint8_t* pieces = pos.pieces(0);
+            for (int k = 0; k < NUM_PIECE; k++) {
+                if (pieces[k] < NUM_GOAL) {
+                    mask |= 1 << pieces[k];
+                } else {
+                    count[hole_class(pieces[k])]++;
+                }
+            }
+            return distance[index(mask, count)];
+        }
+
+        int states() const {
+            return reachable;
+        }
+    private:
+        static constexpr int BASE = NUM_PIECE + 1;
+        static constexpr int SIZE = (1 << NUM_GOAL) * BASE * BASE * BASE * BASE;
+
+        static int index(int mask, const int* count) {
+            return (((mask * BASE + count[0]) * BASE + count[1]) * BASE + count[2]) * BASE + count[3];
+        }
+
+        // breadth first search from the goal, abstract moves are symmetric
+        void build() {
+            std::vector<int> queue;
+            const int zero[NUM_CLASS] = {0, 0, 0, 0};
+            const int goal = index((1 << NUM_GOAL) - 1, zero);
+            distance[goal] = 0;
+            queue.push_back(goal);
+            for (size_t head = 0; head < queue.size(); head++) {
+                int state = queue[head];
+                int count[NUM_CLASS];
+                for (int c = NUM_CLASS - 1; c >= 0; c--) {
+                    count[c] = state % BASE;
+                    state /= BASE;
+                }
+                const int mask = state;
+                const uint8_t next = distance[queue[head]] + 1;
+                // lift a piece from the goal
+                for (int k = 0; k < NUM_GOAL; k++) {
+                    if (!(mask & (1 << k))) {
+                        continue;
+                    }
+                    const int lifted = mask & ~(1 << k);
+                    for (int c = 0; c < NUM_CLASS; c++) {
+                        if (c == goal_class[k] || step_outside[k][c]) {
+                            count[c]++;
+                            visit(index(lifted, count), next, queue);
+                            count[c]--;
+                        }
+                    }
+                    for (int l = 0; l < NUM_GOAL; l++) {
+                        if (!(lifted & (1 << l)) && l != k && (goal_class[l] == goal_class[k] || step_goal[k][l])) {
+                            visit(index(lifted | (1 << l), count), next, queue);
+                        }
+                    }
+                }
+                // lift a piece outside the goal
+                for (int c = 0; c < NUM_CLASS; c++) {
+                    if (count[c] == 0) {
+                        continue;
+                    }
+                    count[c]--;
+                    for (int d = 0; d < NUM_CLASS; d++) {
+                        count[d]++;
+                        visit(index(mask, count), next, queue);
+                        count[d]--;
+                    }
+                    for (int l = 0; l < NUM_GOAL; l++) {
+                        if (!(mask & (1 << l)) && (goal_class[l] == c || step_outside[l][c])) {
+                            visit(index(mask | (1 << l), count), next, queue);
+                        }
+                    }
+                    count[c]++;
+                }
+            }
+            reachable = queue.size();
+        }
+
+        void visit(int state, uint8_t d, std::vector<int>& queue) {
+            if (distance[state] == UNKNOWN) {
+                distance[state] = d;
+                queue.push_back(state);
+            }
+        }
+
+        std::vector<uint8_t> distance;
+        int goal_class[NUM_GOAL];
+        bool step_outside[NUM_GOAL][NUM_CLASS];
+        bool step_goal[NUM_GOAL][NUM_GOAL];
+        int reachable;
+};
+
+// Visited set in a memory mapped file, open addressing with linear probing.
+// An entry packs the state rank, the IDA* iteration and the depth it was
+// reached at; entries of older iterations are reused in place.
+class visited_set {
+    public:
+        visited_set(const char* path, int log2_size): size(1ULL << log2_size), used(0), iteration(0), table(nullptr) {
+            const size_t bytes = size * sizeof(uint64_t);
+            fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+            if (fd < 0 || ftruncate(fd, bytes) != 0) {
+                return;
+            }
+            void* p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if (p != MAP_FAILED) {
+                table = (uint64_t*)p;
+            }
+        }
+
+        ~visited_set() {
+            if (table) {
+                munmap(table, size * sizeof(uint64_t));
+            }
+            if (fd >= 0) {
+                close(fd);
+            }
+        }
+
+        bool ok() const {
+            return table != nullptr;
+        }
+
+        // start a new iteration, older entries become reusable
+        void next_iteration() {
+            iteration = (iteration + 1) & ITERATION_MASK;
+            if (iteration == 0) {
+                memset(table, 0, size * sizeof(uint64_t));
+                used = 0;
+                iteration = 1;
+            }
+        }
+
+        // return true if key was reached at depth g or less in this iteration, else record it
+        bool check_and_set(uint64_t key, int g) {
+            const uint64_t tag = (key + 1) << 16;
+            const uint64_t entry = tag | ((uint64_t)iteration << DEPTH_BITS) | (uint64_t)g;
+            uint64_t reusable = size;
+            for (uint64_t k = hash(key) & (size - 1), probes = 0; probes < MAX_PROBES; k = (k + 1) & (size - 1), probes++) {
+                const uint64_t e = table[k];
+                if (e == 0) {
+                    if (reusable == size) {
+                        reusable = k;
+                        used++;
+                    }
+                    break;
+                }
+                const bool current = ((e >> DEPTH_BITS) & ITERATION_MASK) == (uint64_t)iteration;
+                if ((e & ~0xffffULL) == tag && current) {
+                    if ((int)(e & DEPTH_MASK) <= g) {
+                        return true;
+                    }
+                    table[k] = entry;
+                    return false;
+                }
+                if (!current && reusable == size) {
+                    reusable = k;
+                }
+            }
+            if (reusable != size) {
+                table[reusable] = entry;
+            }
+            return false;
+        }
+
+        uint64_t get_used() const {
+            return used;
+        }
+
+        static constexpr int DEPTH_BITS = 6;
+        // deepest g an entry holds, solves must not search past it
+        static constexpr int MAX_DEPTH = (1 << DEPTH_BITS) - 1;
+    private:
+        static constexpr int MAX_PROBES = 64;
+        static constexpr uint64_t DEPTH_MASK = MAX_DEPTH;
+        static constexpr uint64_t ITERATION_MASK = (1 << (16 - DEPTH_BITS)) - 1;
+
+        static uint64_t hash(uint64_t key) {
+            key ^= key >> 33;
+            key *= 0xff51afd7ed558ccdULL;
+            key ^= key >> 33;
+            return key;
+        }
+
+        const uint64_t size;
+        uint64_t used;
+        int iteration;
+        int fd;
+        uint64_t* table;
+};
+
+constexpr int visited_set::MAX_DEPTH;
+
+// combinatorial rank of the sorted piece holes, below C(121, 10) < 2^47
+class state_ranker {
+    public:
+        state_ranker() {
+            for (int n = 0; n <= NUM_HOLE; n++) {
+                binomial[n][0] = 1;
+                for (int k = 1; k <= NUM_PIECE; k++) {
+                    binomial[n][k] = n == 0 ? 0 : binomial[n - 1][k - 1] + binomial[n - 1][k];
+                }
+            }
+        }
+
+        uint64_t rank(const position& pos) const {
+            uint8_t holes[NUM_PIECE];
+            memcpy(holes, pos.pieces(0), NUM_PIECE);
+            std::sort(holes, holes + NUM_PIECE);
+            uint64_t r = 0;
+            for (int k = 0; k < NUM_PIECE; k++) {
+                r += binomial[holes[k]][k + 1];
+            }
+            return r;
+        }
+    private:
+        uint64_t binomial[NUM_HOLE + 1][NUM_PIECE + 1];
+};
+
+enum heuristic_type {
+    COUNT, PDB
+};
+
+// IDA* over solo positions
+class solver {
+    public:
+        solver(heuristic_type heuristic, const pattern_database& pdb, visited_set& visited):
+            heuristic(heuristic), pdb(pdb), visited(visited) {}
+
+        int estimate(const position& pos) const {
+            if (heuristic == PDB) {
+                return pdb.lookup(pos);
+            }
+            return NUM_PIECE - goal_count(pos);
+        }
+
+        // minimum number of moves, -1 if above max_moves
+        int solve(position pos, int max_moves) {
+            nodes = 0;
+            solution.clear();
+            const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            for (int bound = estimate(pos); bound <= max_moves; ) {
+                const unsigned long long before = nodes;
+                visited.next_iteration();
+                next_bound = NO_BOUND;
+                const std::chrono::steady_clock::time_point t = std::chrono::steady_clock::now();
+                const bool found = search(pos, 0, bound);
+                const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t).count();
+                std::cout << "  bound " << bound << ": " << nodes - before << " nodes, "
+                    << (unsigned long long)((nodes - before) / std::max(seconds, 1e-9)) << " nodes/s, "
+                    << visited.get_used() << " visited entries\n";
+                if (found) {
+                    std::reverse(solution.begin(), solution.end());
+                    seconds_used = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+                    return bound;
+                }
+                if (next_bound == NO_BOUND) {
+                    break;
+                }
+                bound = next_bound;
+            }
+            seconds_used = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            return -1;
+        }
+
+        const std::vector<move>& get_solution() const {
+            return solution;
+        }
+
+        unsigned long long get_nodes() const {
+            return nodes;
+        }
+
+        double get_seconds() const {
+            return seconds_used;
+        }
+    private:
+        static constexpr int NO_BOUND = 1 << 30;
+
+        static int goal_count(const position& pos) {
+            int count = 0;
+            for (int k = 0; k < NUM_PIECE; k++) {
+                count += pos.pieces(0)[k] < NUM_GOAL;
+            }
+            return count;
+        }
+
+        bool search(position& pos, int g, int bound) {
+            nodes++;
+            const int f = g + estimate(pos);
+            if (f > bound) {
+                next_bound = std::min(next_bound, f);
+                return false;
+            }
+            if (pos.finished(0)) {
+                return true;
+            }
+            if (visited.check_and_set(ranker.rank(pos), g)) {
+                return false;
+            }
+            move moves[MAX_MOVES];
+            const int n = pos.generate(moves);
+            for (int k = 0; k < n; k++) {
+                pos.play(moves[k]);
+                pos.pass();
+                const bool found = search(pos, g + 1, bound);
+                pos.pass();
+                pos.undo(moves[k]);
+                if (found) {
+                    solution.push_back(moves[k]);
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        const heuristic_type heuristic;
+        const pattern_database& pdb;
+        visited_set& visited;
+        state_ranker ranker;
+        unsigned long long nodes;
+        int next_bound;
+        double seconds_used;
+        std::vector<move> solution;
+};
+
+// position reached from the goal by random moves, moves are reversible
+position scramble(int moves) {
+    uint8_t goal[NUM_PIECE];
+    for (int k = 0; k < NUM_PIECE; k++) {
+        goal[k] = k;
+    }
+    position pos;
+    pos.solo(goal);
+    move list[MAX_MOVES];
+    for (int k = 0; k < moves; k++) {
+        const int n = pos.generate(list);
+        pos.play(list[rand() % n]);
+        pos.pass();
+    }
+    return pos;
+}
+
+int main(int argc, char* argv[]) {
+    const char* usage = " [-H count|pdb] [-r random_moves] [-n instances] [-m max_moves] [-f visited_file] [-s log2_entries]\n";
+    heuristic_type heuristic = PDB;
+    bool compare = true;
+    int random_moves = 0;
+    int instances = 1;
+    int max_moves = visited_set::MAX_DEPTH;
+    const char* path = "solver_visited.bin";
+    int log2_entries = 24;
+    int opt;
+    while ((opt = getopt(argc, argv, "H:r:n:m:f:s:")) != -1) {
+        switch (opt) {
+            case 'H':
+                compare = false;
+                if (strcmp(optarg, "count") == 0) {
+                    heuristic = COUNT;
+                } else if (strcmp(optarg, "pdb") == 0) {
+                    heuristic = PDB;
+                } else {
+                    std::cerr << "Usage: " << argv[0] << usage;
+                    return 1;
+                }
+                break;
+            case 'r':
+                random_moves = atoi(optarg);
+                break;
+            case 'n':
+                instances = atoi(optarg);
+                break;
+            case 'm':
+                max_moves = atoi(optarg);
+                if (max_moves < 0 || max_moves > visited_set::MAX_DEPTH) {
+                    std::cerr << "max_moves must be 0 to " << visited_set::MAX_DEPTH << "\n";
+                    return 1;
+                }
+                break;
+            case 'f':
+                path = optarg;
+                break;
+            case 's':
+                log2_entries = atoi(optarg);
+                break;
+            default:
+                std::cerr << "Usage: " << argv[0] << usage;
+                return 1;
+        }
+    }
+
+    visited_set visited(path, log2_entries);
+    if (!visited.ok()) {
+        std::cerr << "Cannot map visited set file " << path << "\n";
+        return 1;
+    }
+    pattern_database pdb;
+    std::cout << "Pattern database: " << pdb.states() << " abstract states\n";
+
+    srand(1);
+    for (int instance = 0; instance < instances; instance++) {
+        position pos;
+        if (random_moves > 0) {
+            pos = scramble(random_moves);
+        } else {
+            pos.solo();
+        }
+        std::cout << "Instance " << instance + 1 << "\n";
+        for (int h = COUNT; h <= PDB; h++) {
+            if (!compare && h != heuristic) {
+                continue;
+            }
+            solver s((heuristic_type)h, pdb, visited);
+            std::cout << (h == PDB ? " pdb" : " count") << " heuristic, root estimate " << s.estimate(pos) << "\n";
+            const int moves = s.solve(pos, max_moves);
+            if (moves < 0) {
+                std::cout << " no solution within " << max_moves << " moves";
+            } else {
+                std::cout << " " << moves << " moves:";
+                for (const move& m: s.get_solution()) {
+                    std::cout << " " << position::name(m.from) << "->" << position::name(m.to);
+                }
+            }
+            std::cout << "\n " << s.get_nodes() << " nodes in " << s.get_seconds() << " s, "
+                << (unsigned long long)(s.get_nodes() / std::max(s.get_seconds(), 1e-9)) << " nodes/s";
+            if (moves > 0) {
+                std::cout << ", estimate/optimal " << (double)s.estimate(pos) / moves;
+            }
+            std::cout << "\n";
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,150 @@
+#include <cstdint>  // uint8_t, uint16_t, uint64_t
+#include <cstdlib>  // atoi
+#include <iostream> // cout, cerr
+#include <vector>   // vector
+
+#include "position.hpp"
+#include "tablebase.hpp"
+
+// Generates the endgame tablebase by retrograde analysis. Moves are
+// reversible, so the predecessors of a position are the moves of the side
+// that just moved. Moves leaving the table (more than K pieces outside the
+// goal) are not considered.
+
+constexpr uint16_t INVALID = 0xffff;
+
+class generator {
+    public:
+        generator(int max_outside): tb(max_outside), value(tb.size(), tablebase::UNKNOWN), children(tb.size(), 0) {}
+
+        void run() {
+            initialize();
+            for (int plies = 0; plies < tablebase::MAX_PLIES; plies++) {
+                uint64_t resolved = 0;
+                for (uint64_t i = 0; i < value.size(); i++) {
+                    if (value[i] == (tablebase::LOSS | plies) || (plies > 0 && value[i] == plies)) {
+                        resolved += retract(i, plies);
+                    }
+                }
+                std::cout << "ply " << plies + 1 << ": " << resolved << " positions resolved\n";
+                if (resolved == 0 && plies > 0) {
+                    break;
+                }
+            }
+            uint64_t count[3] = {0, 0, 0};
+            for (uint64_t i = 0; i < value.size(); i++) {
+                if (children[i] == INVALID) {
+                    continue;
+                }
+                count[value[i] == tablebase::UNKNOWN ? 0 : (value[i] & tablebase::LOSS) ? 2 : 1]++;
+            }
+            std::cout << count[1] << " wins, " << count[2] << " losses, " << count[0] << " unresolved\n";
+        }
+
+        bool save(const char* path) {
+            return tb.save(path, value.data());
+        }
+    private:
+        // position of entry i, return false if pieces overlap
+        bool load(uint64_t i, position& pos) {
+            uint8_t holes[NUM_PLAYER][NUM_PIECE];
+            const uint64_t sides = i / NUM_PLAYER;
+            tb.side_holes(0, sides / tb.side_size(), holes[0]);
+            tb.side_holes(1, sides % tb.side_size(), holes[1]);
+            bool used[NUM_HOLE] = {false};
+            for (int s = 0; s < NUM_PLAYER; s++) {
+                for (int k = 0; k < NUM_PIECE; k++) {
+                    if (used[holes[s][k]]) {
+                        return false;
+                    }
+                    used[holes[s][k]] = true;
+                }
+            }
+            pos.setup(holes[0], holes[1], i % NUM_PLAYER);
+            return true;
+        }
+
+        // true if m keeps the side to move within the table
+        bool in_table(const position& pos, const move& m) {
+            const position::geometry& g = position::geo();
+            const int side = pos.side_to_move();
+            return pos.outside(side) + g.in_goal[side][m.from] - g.in_goal[side][m.to] <= tb.get_max_outside();
+        }
+
+        // mark terminal positions and count moves of the others
+        void initialize() {
+            move moves[MAX_MOVES];
+            position pos;
+            for (uint64_t i = 0; i < value.size(); i++) {
+                if (!load(i, pos) || pos.finished(pos.side_to_move())) {
+                    children[i] = INVALID;
+                } else if (pos.finished(1 - pos.side_to_move())) {
+                    value[i] = tablebase::LOSS;
+                } else {
+                    const int n = pos.generate(moves);
+                    for (int k = 0; k < n; k++) {
+                        children[i] += in_table(pos, moves[k]);
+                    }
+                }
+            }
+        }
+
+        // resolve predecessors of entry i decided in plies, return number resolved
+        uint64_t retract(uint64_t i, int plies) {
+            move moves[MAX_MOVES];
+            position pos;
+            load(i, pos);
+            const bool lost = value[i] & tablebase::LOSS;
+            uint64_t resolved = 0;
+            pos.pass();
+            const int n = pos.generate(moves);
+            for (int k = 0; k < n; k++) {
+                if (!in_table(pos, moves[k])) {
+                    continue;
+                }
+                pos.play(moves[k]);
+                pos.pass();
+                const uint64_t j = tb.index(pos);
+                if (children[j] != INVALID && value[j] == tablebase::UNKNOWN) {
+                    if (lost) {
+                        value[j] = plies + 1;
+                        resolved++;
+                    } else if (--children[j] == 0) {
+                        value[j] = tablebase::LOSS | (plies + 1);
+                        resolved++;
+                    }
+                }
+                pos.pass();
+                pos.undo(moves[k]);
+            }
+            return resolved;
+        }
+
+        tablebase tb;
+        std::vector<uint8_t> value;
+        std::vector<uint16_t> children;
+};
+
+int main(int argc, char* argv[]) {
+    if (argc < 2 || argc > 3) {
+        std::cerr << "Usage: " << argv[0] << " <max pieces outside goal> [file]\n";
+        return 1;
+    }
+    const int max_outside = atoi(argv[1]);
+    const char* path = argc == 3 ? argv[2] : TABLEBASE_PATH;
+    if (max_outside < 0 || max_outside > MAX_TABLEBASE_OUTSIDE) {
+        std::cerr << "Pieces outside goal must be between 0 and " << MAX_TABLEBASE_OUTSIDE << ".\n";
+        return 1;
+    }
+
+    generator gen(max_outside);
+    std::cout << "Generating " << tablebase(max_outside).size() << " entries\n";
+    gen.run();
+    if (!gen.save(path)) {
+        std::cerr << "Cannot write " << path << "\n";
+        return 1;
+    }
+    std::cout << "Saved " << path << "\n";
+
+    return 0;
+}
@@ -0,0 +1,172 @@
+#ifndef CLUSTER_HPP
+#define CLUSTER_HPP
+
+#include <cstdint>      // uint32_t
+#include <cstring>      // memcpy
+#include <functional>   // function
+#include <memory>       // unique_ptr
+#include <stdexcept>    // runtime_error
+#include <string>       // string
+#include <sys/socket.h> // socketpair, sendmsg, recvmsg, SCM_RIGHTS
+#include <unistd.h>     // close
+#include <vector>       // vector
+
+#include <boost/asio.hpp>
+
+#include "common.hpp"
+
+// worker process owning a room, the same in every process of a server
+inline int room_owner(const std::string& name, int workers) {
+    // FNV-1a, so every build agrees
+    uint32_t h = 2166136261u;
+    for (char c: name) {
+        h = (h ^ (unsigned char)c) * 16777619u;
+    }
+    return h % workers;
+}
+
+// Worker that should serve a connection from a frame on: the owner of the
+// room for a login, of the rating bucket for a match, local for anything
+// else. Checked on every login and match, a connection may move between
+// workers while it is in no room and waits for no match.
+inline int frame_owner(char command, const char* payload, size_t length, int local, int workers) {
+    if (command == commands::IN && length >= 1) {
+        return room_owner(std::string(payload + 1, length - 1), workers);
+    } else if (command == commands::MATCH && length <= 1) {
+        return (length == 1 ? (unsigned char)payload[0] : 0) % workers;
+    }
+    return local;
+}
+
+// Sockets linking every pair of worker processes, made before they fork.
+// ends[i][j] is the end of worker i towards worker j.
+struct worker_mesh {
+    explicit worker_mesh(int workers): ends(workers, std::vector<int>(workers, -1)) {
+        for (int i = 0; i < workers; i++) {
+            for (int j = i + 1; j < workers; j++) {
+                int pair[2];
+                if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, pair) != 0) {
+                    throw std::runtime_error("Failed to link worker processes");
+                }
+                ends[i][j] = pair[0];
+                ends[j][i] = pair[1];
+            }
+        }
+    }
+
+    // ends of worker, the others are closed in its process
+    std::vector<int> keep(int worker) {
+        for (int i = 0; i < (int)ends.size(); i++) {
+            if (i == worker) {
+                continue;
+            }
+            for (int fd: ends[i]) {
+                if (fd >= 0) {
+                    ::close(fd);
+                }
+            }
+        }
+        return ends[worker];
+    }
+
+    std::vector<std::vector<int> > ends;
+};
+
+// Passes connections between the worker processes of a server. A connection
+// is sent over the link to its owner as its descriptor (SCM_RIGHTS) with the
+// bytes read from it so far, in one packet, and the owner serves it as if it
+// had accepted it. Processes share no memory, so nothing is locked across them.
+class connection_handoff {
+    public:
+        // called with a connection handed over and the bytes read from it
+        typedef std::function<void(int fd, const std::string& received)> receiver_type;
+
+        // more is never read before the first frame is whole
+        static constexpr int MAX_RECEIVED = 8192;
+
+        connection_handoff(boost::asio::io_context& io_context, int worker, const std::vector<int>& links, receiver_type receiver):
+            worker(worker), receiver(receiver) {
+            for (int fd: links) {
+                links_.emplace_back(fd < 0 ? nullptr : new boost::asio::posix::stream_descriptor(io_context, fd));
+            }
+            for (int w = 0; w < (int)links_.size(); w++) {
+                if (links_[w]) {
+                    receive(w);
+                }
+            }
+        }
+
+        int get_worker() const {
+            return worker;
+        }
+
+        int get_workers() const {
+            return links_.size();
+        }
+
+        // send a connection to worker to, false if its link is full or broken
+        bool send(int to, int fd, const std::string& received) {
+            if (!links_[to] || received.length() > MAX_RECEIVED) {
+                return false;
+            }
+            struct iovec iov;
+            iov.iov_base = const_cast<char*>(received.data());
+            iov.iov_len = received.length();
+            char control[CMSG_SPACE(sizeof(int))] = {};
+            struct msghdr msg = {};
+            msg.msg_iov = &iov;
+            msg.msg_iovlen = 1;
+            msg.msg_control = control;
+            msg.msg_controllen = sizeof(control);
+            struct cmsghdr* c = CMSG_FIRSTHDR(&msg);
+            c->cmsg_level = SOL_SOCKET;
+            c->cmsg_type = SCM_RIGHTS;
+            c->cmsg_len = CMSG_LEN(sizeof(int));
+            memcpy(CMSG_DATA(c), &fd, sizeof(int));
+            return sendmsg(links_[to]->native_handle(), &msg, MSG_DONTWAIT | MSG_NOSIGNAL) == (ssize_t)received.length();
+        }
+    private:
+        // take every connection waiting on the link from worker w
+        void receive(int w) {
+            links_[w]->async_wait(boost::asio::posix::stream_descriptor::wait_read, [this, w](boost::system::error_code ec) {
+                    if (ec) {
+                        return;
+                    }
+                    char data[MAX_RECEIVED];
+                    char control[CMSG_SPACE(sizeof(int))];
+                    for (;;) {
+                        struct iovec iov;
+                        iov.iov_base = data;
+                        iov.iov_len = sizeof(data);
+                        struct msghdr msg = {};
+                        msg.msg_iov = &iov;
+                        msg.msg_iovlen = 1;
+                        msg.msg_control = control;
+                        msg.msg_controllen = sizeof(control);
+                        const ssize_t n = recvmsg(links_[w]->native_handle(), &msg, MSG_DONTWAIT | MSG_CMSG_CLOEXEC);
+                        if (n == 0) {
+                            // the worker is gone
+                            return;
+                        } else if (n < 0) {
+                            break;
+                        }
+                        struct cmsghdr* c = CMSG_FIRSTHDR(&msg);
+                        if (!c || c->cmsg_level != SOL_SOCKET || c->cmsg_type != SCM_RIGHTS) {
+                            continue;
+                        }
+                        int fd;
+                        memcpy(&fd, CMSG_DATA(c), sizeof(int));
+                        receiver(fd, std::string(data, n));
+                    }
+                    receive(w);
+                    });
+        }
+
+        const int worker;
+        receiver_type receiver;
+        std::vector<std::unique_ptr<boost::asio::posix::stream_descriptor> > links_;
+};
+
+constexpr int connection_handoff::MAX_RECEIVED;
+
+#endif
@@ -1,12 +1,16 @@
 #ifndef COMMON_HPP
 #define COMMON_HPP
 
+#include <cstddef> // size_t
+#include <string>  // string
+
 namespace commands {
     enum {
         PUT = 'P',
-        GET = 'G',
+        SNAPSHOT = 'N',
         IN  = 'I',
-        OUT = 'O'
+        OUT = 'O',
+        MATCH = 'M'
     };
 };
 
@@ -18,6 +22,100 @@ namespace success_fail {
 };
 
 constexpr char NUM_PLAYER = 2;
+// player of a read-only spectator
+constexpr int SPECTATOR = -1;
 constexpr int MAX_ROOM_NAME_LENGTH = 60;
 
+// Every message is a frame: one byte counting the bytes that follow, the
+// command, then its payload. Client to server: PUT key, IN player + 1 (0 for
+// a spectator) and room name, OUT, MATCH and an optional rating bucket.
+// Server to client: SUCCESS or FAIL answering IN, SNAPSHOT of the game after
+// SUCCESS, PUT key of the opponent, or of either player in the view of
+// player 0 for spectators. A match is answered with MATCH, player + 1 and
+// the room, followed by the reply to a login to that seat, or with FAIL.
+constexpr int MAX_FRAME_LENGTH = 255;
+
+inline void append_frame(std::string& out, char command, const char* payload = nullptr, size_t length = 0) {
+    out += (char)(length + 1);
+    out += command;
+    out.append(payload, length);
+}
+
+// Incremental frame decoder. Bytes are fed as they arrive however TCP splits
+// them, whole frames are taken out in order.
+class frame_reader {
+    public:
+        frame_reader(): offset(0) {}
+
+        void feed(const char* data, size_t length) {
+            if (offset > 0 && offset * 2 >= buffer.size()) {
+                buffer.erase(0, offset);
+                offset = 0;
+            }
+            buffer.append(data, length);
+        }
+
+        // take the next whole frame, payload is valid until the next feed
+        // return false if none or malformed
+        bool next(char& command, const char*& payload, size_t& length) {
+            if (offset >= buffer.size()) {
+                return false;
+            }
+            const size_t frame_length = (unsigned char)buffer[offset];
+            if (frame_length == 0) {
+                malformed = true;
+                return false;
+            }
+            if (buffer.size() - offset < frame_length + 1) {
+                return false;
+            }
+            command = buffer[offset + 1];
+            payload = buffer.data() + offset + 2;
+            length = frame_length - 1;
+            last = offset;
+            offset += frame_length + 1;
+            return true;
+        }
+
+        // the frame taken last and every byte after it, to pass the stream
+        // on; valid until the next feed
+        std::string from_last() const {
+            return buffer.substr(last);
+        }
+
+        // true once an invalid frame was seen, the stream cannot be resynchronized
+        bool is_malformed() const {
+            return malformed;
+        }
+    private:
+        std::string buffer;
+        size_t offset;
+        size_t last = 0;
+        bool malformed = false;
+};
+
+constexpr int M = 17;
+constexpr int N = 25;
+constexpr char CHAR_NONE = ' ';
+constexpr char CHAR_EMPTY = 'O';
+constexpr char CHAR_PLAYER[] = {'@', '*'};
+constexpr char INIT_BOARD[M * N + 1] =
+"            *            "
+"           * *           "
+"          * * *          "
+"         * * * *         "
+"O O O O O O O O O O O O O"
+" O O O O O O O O O O O O "
+"  O O O O O O O O O O O  "
+"   O O O O O O O O O O   "
+"    O O O O O O O O O    "
+"   O O O O O O O O O O   "
+"  O O O O O O O O O O O  "
+" O O O O O O O O O O O O "
+"O O O O O O O O O O O O O"
+"         @ @ @ @         "
+"          @ @ @          "
+"           @ @           "
+"            @            ";
+
 #endif
@@ -0,0 +1,282 @@
+#ifndef EVENT_LOG_HPP
+#define EVENT_LOG_HPP
+
+#include <algorithm>          // max
+#include <atomic>             // atomic
+#include <cerrno>             // errno, EINTR
+#include <chrono>             // system_clock, milliseconds
+#include <condition_variable> // condition_variable
+#include <cstdint>            // uint32_t, uint64_t
+#include <cstdio>             // FILE, fopen, fread, snprintf
+#include <cstdlib>            // atoll
+#include <cstring>            // memcmp, strncmp
+#include <dirent.h>           // opendir, readdir
+#include <fcntl.h>            // open
+#include <functional>         // hash
+#include <iostream>           // cerr
+#include <mutex>              // mutex, unique_lock
+#include <string>             // string
+#include <sys/stat.h>         // mkdir
+#include <thread>             // thread
+#include <unistd.h>           // write, fdatasync, close
+#include <vector>             // vector
+
+#include "lockable.hpp"
+
+constexpr char EVENT_LOG_MAGIC[8] = {'C', 'C', 'E', 'V', '0', '0', '0', '1'};
+
+// Room event as logged. Keys are in the view of player 0, sequence counts
+// the keys played in the room once the event is applied.
+struct room_event {
+    enum type_type {
+        LOGIN = 'I',
+        LOGOUT = 'O',
+        PUT = 'P'
+    };
+
+    char type;
+    // microseconds since the epoch
+    uint64_t time;
+    uint32_t sequence;
+    int player;
+    std::string room;
+    std::string keys;
+
+    // record length, type, time, sequence, player, room name length, room name, keys
+    void encode(std::string& out) const {
+        const uint32_t length = 1 + 8 + 4 + 1 + 1 + room.length() + keys.length();
+        put_number(out, length, 4);
+        out += type;
+        put_number(out, time, 8);
+        put_number(out, sequence, 4);
+        out += (char)player;
+        out += (char)room.length();
+        out += room;
+        out += keys;
+    }
+
+    // decode a record of length bytes following its length field
+    bool decode(const char* p, uint32_t length) {
+        if (length < 15 || length < 15 + (uint32_t)(unsigned char)p[14]) {
+            return false;
+        }
+        type = p[0];
+        time = get_number(p + 1, 8);
+        sequence = get_number(p + 9, 4);
+        player = p[13];
+        room.assign(p + 15, (unsigned char)p[14]);
+        keys.assign(p + 15 + room.length(), length - 15 - room.length());
+        return true;
+    }
+
+    static void put_number(std::string& out, uint64_t n, int bytes) {
+        for (int shift = (bytes - 1) * 8; shift >= 0; shift -= 8) {
+            out += (char)(n >> shift);
+        }
+    }
+
+    static uint64_t get_number(const char* p, int bytes) {
+        uint64_t n = 0;
+        for (int b = 0; b < bytes; b++) {
+            n = n << 8 | (unsigned char)p[b];
+        }
+        return n;
+    }
+};
+
+// where and how the event log is written, no log without a directory
+struct event_log_options {
+    std::string directory;
+    int shards = 8;
+    // a batch is committed once this many events are pending or this long after the last
+    int batch_events = 4096;
+    int batch_milliseconds = 10;
+    // a segment is closed and the next one started past this size
+    size_t segment_bytes = 64 << 20;
+};
+
+// Append-only log of room events split into shards by room name. Rooms
+// append to the pending batch of their shard under its lock, a thread of its
+// own commits every batch with one write and one fdatasync per shard, so no
+// event loop thread ever waits for the disk. Shard s writes segments named
+// shard-s-n.log, numbered on from those already in the directory.
+class event_log {
+    public:
+        explicit event_log(const event_log_options& options):
+            options(options), shards(options.shards), pending_events(0), stopping(false) {
+            mkdir(options.directory.c_str(), 0755);
+            for (int s = 0; s < options.shards; s++) {
+                shards[s].segment = last_segment(s);
+                open_segment(s);
+            }
+            writer = std::thread([this]() {
+                    run();
+                    });
+        }
+
+        ~event_log() {
+            {
+                std::lock_guard<std::mutex> lck(mtx);
+                stopping = true;
+            }
+            cv.notify_one();
+            writer.join();
+            for (shard& sh: shards) {
+                if (sh.fd >= 0) {
+                    ::close(sh.fd);
+                }
+            }
+        }
+
+        // queue an event for the next commit, callable from any thread
+        void append(const room_event& event) {
+            shard& sh = shards[std::hash<std::string>()(event.room) % shards.size()];
+            sh.lock();
+            event.encode(sh.pending);
+            sh.unlock();
+            if (pending_events.fetch_add(1, std::memory_order_relaxed) + 1 == options.batch_events) {
+                cv.notify_one();
+            }
+        }
+
+        // write all of data, retrying short writes
+        static bool write_all(int fd, const std::string& data) {
+            size_t done = 0;
+            while (done < data.length()) {
+                const ssize_t n = ::write(fd, data.data() + done, data.length() - done);
+                if (n < 0 && errno != EINTR) {
+                    return false;
+                }
+                done += n < 0 ? 0 : n;
+            }
+            return true;
+        }
+    private:
+        struct shard: public lockable {
+            std::string pending;
+            std::string writing;
+            int fd = -1;
+            uint64_t segment = 0;
+            size_t written = 0;
+        };
+
+        void run() {
+            std::unique_lock<std::mutex> lck(mtx);
+            while (!stopping) {
+                cv.wait_for(lck, std::chrono::milliseconds(options.batch_milliseconds), [this]() {
+                        return stopping || pending_events.load(std::memory_order_relaxed) >= options.batch_events;
+                        });
+                lck.unlock();
+                commit();
+                lck.lock();
+            }
+            lck.unlock();
+            commit();
+        }
+
+        // write and sync the pending batch of every shard
+        void commit() {
+            pending_events.store(0, std::memory_order_relaxed);
+            for (int s = 0; s < (int)shards.size(); s++) {
+                shard& sh = shards[s];
+                sh.lock();
+                sh.writing.swap(sh.pending);
+                sh.unlock();
+                if (sh.writing.empty() || sh.fd < 0) {
+                    sh.writing.clear();
+                    continue;
+                }
+                if (!write_all(sh.fd, sh.writing) || fdatasync(sh.fd) != 0) {
+                    std::cerr << "Failed to write the event log of shard " << s << "\n";
+                }
+                sh.written += sh.writing.length();
+                sh.writing.clear();
+                if (sh.written >= options.segment_bytes) {
+                    ::close(sh.fd);
+                    open_segment(s);
+                }
+            }
+        }
+
+        std::string segment_path(int s, uint64_t n) const {
+            char name[64];
+            snprintf(name, sizeof(name), "/shard-%d-%06llu.log", s, (unsigned long long)n);
+            return options.directory + name;
+        }
+
+        // number of the newest segment of shard s in the directory, 0 if none
+        uint64_t last_segment(int s) const {
+            uint64_t last = 0;
+            const std::string prefix = "shard-" + std::to_string(s) + "-";
+            if (DIR* dir = opendir(options.directory.c_str())) {
+                while (dirent* entry = readdir(dir)) {
+                    if (strncmp(entry->d_name, prefix.c_str(), prefix.length()) == 0) {
+                        last = std::max(last, (uint64_t)atoll(entry->d_name + prefix.length()));
+                    }
+                }
+                closedir(dir);
+            }
+            return last;
+        }
+
+        void open_segment(int s) {
+            shard& sh = shards[s];
+            sh.segment++;
+            sh.written = 0;
+            sh.fd = ::open(segment_path(s, sh.segment).c_str(), O_WRONLY | O_CREAT | O_EXCL | O_APPEND, 0644);
+            if (sh.fd < 0 || !write_all(sh.fd, std::string(EVENT_LOG_MAGIC, sizeof(EVENT_LOG_MAGIC)))) {
+                std::cerr << "Failed to open an event log segment of shard " << s << "\n";
+            }
+        }
+
+        const event_log_options options;
+        std::vector<shard> shards;
+        std::atomic<int> pending_events;
+        std::mutex mtx;
+        std::condition_variable cv;
+        bool stopping;
+        std::thread writer;
+};
+
+// Reads the events of one segment in order through a small buffer, so
+// segments of any size can be read while being written. A record cut short
+// by a crash ends the segment.
+class event_reader {
+    public:
+        event_reader(): f(nullptr) {}
+
+        ~event_reader() {
+            if (f) {
+                fclose(f);
+            }
+        }
+
+        // open a segment, false if missing or not a segment
+        bool open(const char* path) {
+            f = fopen(path, "rb");
+            char magic[sizeof(EVENT_LOG_MAGIC)];
+            return f && fread(magic, 1, sizeof(magic), f) == sizeof(magic) &&
+                memcmp(magic, EVENT_LOG_MAGIC, sizeof(magic)) == 0;
+        }
+
+        // false at the end of the segment
+        bool next(room_event& event) {
+            char header[4];
+            if (fread(header, 1, sizeof(header), f) != sizeof(header)) {
+                return false;
+            }
+            const uint32_t length = room_event::get_number(header, 4);
+            if (length > MAX_RECORD_LENGTH) {
+                return false;
+            }
+            record.resize(length);
+            return fread(&record[0], 1, length, f) == length && event.decode(record.data(), length);
+        }
+    private:
+        static constexpr uint32_t MAX_RECORD_LENGTH = 1 << 20;
+
+        FILE* f;
+        std::string record;
+};
+
+#endif
@@ -0,0 +1,844 @@
+#ifndef GAME_BOARD_HPP
+#define GAME_BOARD_HPP
+
+#include <algorithm> // reverse
+#include <chrono>    // milliseconds
+#include <cstdint>   // uint32_t
+#include <cstdlib>   // system
+#include <cstring>   // memcpy
+#include <iostream>  // cout
+#include <string>    // string
+#include <thread>    // this_thread
+#include <vector>    // vector
+
+#include "board.hpp"
+#include "common.hpp"
+#include "direction.hpp"
+#include "position.hpp"
+
+constexpr int SNAPSHOT_LENGTH = (NUM_HOLE + 3) / 4;
+
+// Game state sent to a player at login: number of keys applied to the game,
+// player to move, number of PUT frames following that replay the turn in
+// progress, and the holes at the start of the turn.
+struct snapshot_message {
+    static constexpr size_t LENGTH = 7 + SNAPSHOT_LENGTH;
+
+    uint32_t sequence;
+    int current_player;
+    int turn_keys;
+    std::string holes;
+
+    std::string encode() const {
+        std::string out;
+        for (int shift = 24; shift >= 0; shift -= 8) {
+            out += (char)(sequence >> shift);
+        }
+        out += (char)current_player;
+        out += (char)(turn_keys >> 8);
+        out += (char)turn_keys;
+        return out + holes;
+    }
+
+    bool decode(const char* payload, size_t length) {
+        if (length != LENGTH || (payload[4] != 0 && payload[4] != 1)) {
+            return false;
+        }
+        const unsigned char* p = (const unsigned char*)payload;
+        sequence = (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+        current_player = p[4];
+        turn_keys = p[5] << 8 | p[6];
+        holes.assign(payload + 7, SNAPSHOT_LENGTH);
+        return true;
+    }
+};
+
+enum status_type {
+    PLAYER_WIN, PLAYER_CHANGE, CONTROL_CONT
+};
+
+class game_board: public board<char> {
+    public:
+        game_board(bool need_swap, int my_player = 0): board(::M, ::N), need_swap(need_swap), my_player(my_player) {}
+
+        // next status of board
+        status_type next(char c) {
+            if (c == 'r') {
+                if (selected) {
+                    replay();
+                }
+            } else if (c == ' ') {
+                if (selected) {
+                    selected = false;
+                    if (!trace.empty()) {
+                        if (need_swap) {
+                            if (check_win_from_top()) {
+                                return PLAYER_WIN;
+                            }
+                        } else {
+                            if (my_player == current_player) {
+                                if (check_win_from_top()) {
+                                    return PLAYER_WIN;
+                                }
+                            } else {
+                                if (check_win_from_bottom()) {
+                                    return PLAYER_WIN;
+                                }
+                            }
+                        }
+                        current_player = (current_player + 1) % NUM_PLAYER;
+                        if (need_swap) {
+                            std::reverse(brd, brd + MN);
+                            find_from_bottom();
+                        } else {
+                            if (my_player == current_player) {
+                                find_from_bottom();
+                            } else {
+                                find_from_top();
+                            }
+                        }
+                        trace.clear();
+                        return PLAYER_CHANGE;
+                    }
+                } else {
+                    selected = true;
+                }
+            } else {
+                direction_6::Enum direct;
+                switch(c) {
+                    case 'a':
+                        [[fallthrough]];
+                    case 'h':
+                        direct = direction_6::LEFT;
+                        break;
+                    case 'w':
+                        [[fallthrough]];
+                    case 'u':
+                        direct = direction_6::LEFT_UP;
+                        break;
+                    case 'e':
+                        [[fallthrough]];
+                    case 'i':
+                        direct = direction_6::RIGHT_UP;
+                        break;
+                    case 'd':
+                        [[fallthrough]];
+                    case 'k':
+                        direct = direction_6::RIGHT;
+                        break;
+                    case 'x':
+                        [[fallthrough]];
+                    case 'm':
+                        direct = direction_6::RIGHT_DOWN;
+                        break;
+                    case 'z':
+                        [[fallthrough]];
+                    case 'n':
+                        direct = direction_6::LEFT_DOWN;
+                        break;
+                    default:
+                        return CONTROL_CONT;
+                }
+                if (selected) {
+                    if (trace.size() == 1 &&
+                            last_direction == direct &&
+                            move_type == SINGLE_STEP &&
+                            has_optional()) {
+                        move_type = HOP;
+                        move_to(optional_i, optional_j);
+                        no_optional();
+                    } else {
+                        int stored_optional_i = optional_i;
+                        int stored_optional_j = optional_j;
+                        if (move_selected(direct)) {
+                            last_direction = direct;
+                        } else {
+                            optional_i = stored_optional_i;
+                            optional_j = stored_optional_j;
+                        }
+                    }
+                } else {
+                    move_unselected(direct);
+                }
+            }
+            return CONTROL_CONT;
+        }
+
+        // play as player from the next init
+        void set_player(int player) {
+            my_player = player;
+        }
+
+        // reset board to initial status
+        void init() {
+            memcpy(brd, INIT_BOARD, M * N * sizeof(char));
+            current_player = 0;
+            if (my_player == 0) {
+                find_from_bottom();
+            } else {
+                std::reverse(brd, brd + MN);
+                find_from_top();
+            }
+            selected = false;
+            trace.clear();
+        }
+
+        // true if trace is empty
+        bool trace_empty() {
+            return trace.empty();
+        }
+
+        // true if key c ends the move in progress
+        bool finishes_move(char c) {
+            return c == ' ' && selected && !trace.empty();
+        }
+
+        // current player
+        int get_current_player() {
+            return current_player;
+        }
+
+        // engine position of the board, call at the start of a turn
+        position get_position() {
+            const bool up = need_swap || my_player == current_player;
+            const char mine = CHAR_PLAYER[current_player];
+            const char other = CHAR_PLAYER[(current_player + 1) % NUM_PLAYER];
+            position pos;
+            pos.load(*this, up ? mine : other, up ? other : mine, up ? 0 : 1);
+            return pos;
+        }
+
+        // holes as seen by player 0, two bits each for empty, player 0 and player 1.
+        // Call at the start of a turn, for boards that are not swapped. Fills
+        // packed in place, so a string kept across turns is not allocated again.
+        void snapshot(std::string& packed) {
+            const position::geometry& g = position::geo();
+            packed.assign(SNAPSHOT_LENGTH, '\0');
+            for (int h = 0; h < NUM_HOLE; h++) {
+                const char c = my_player == 0 ? at(g.row[h], g.col[h]) : at(M - 1 - g.row[h], N - 1 - g.col[h]);
+                const int v = c == CHAR_PLAYER[0] ? 1 : (c == CHAR_PLAYER[1] ? 2 : 0);
+                packed[h / 4] |= v << (h % 4 * 2);
+            }
+        }
+
+        // start the turn of current_player on the holes of a snapshot
+        void restore(const std::string& packed, int current_player) {
+            const position::geometry& g = position::geo();
+            memcpy(brd, INIT_BOARD, M * N * sizeof(char));
+            for (int h = 0; h < NUM_HOLE; h++) {
+                const int v = (packed[h / 4] >> (h % 4 * 2)) & 3;
+                char& c = my_player == 0 ? at(g.row[h], g.col[h]) : at(M - 1 - g.row[h], N - 1 - g.col[h]);
+                c = v == 0 ? CHAR_EMPTY : CHAR_PLAYER[v - 1];
+            }
+            this->current_player = current_player;
+            if (my_player == current_player) {
+                find_from_bottom();
+            } else {
+                find_from_top();
+            }
+            selected = false;
+            trace.clear();
+        }
+
+        // keys moving current player along m, empty if the cursor cannot reach the piece
+        std::string keys_for(const move& m) {
+            static const char KEYS[NUM_DIRECTION] = {'a', 'w', 'e', 'z', 'x', 'd'};
+            const position::geometry& g = position::geo();
+            int parent[MN];
+            char parent_key[MN];
+            int queue[MN];
+            int head = 0;
+            int tail = 0;
+            const int start = current_i * N + current_j;
+            const int target = g.row[m.from] * N + g.col[m.from];
+            for (int k = 0; k < MN; k++) {
+                parent[k] = -1;
+            }
+            parent[start] = start;
+            queue[tail++] = start;
+            while (head < tail && parent[target] < 0) {
+                const int from = queue[head++];
+                for (int d = 0; d < NUM_DIRECTION; d++) {
+                    int planned_i;
+                    int planned_j;
+                    if (find_unselected((direction_6::Enum)d, from / N, from % N, planned_i, planned_j)) {
+                        const int to = planned_i * N + planned_j;
+                        if (parent[to] < 0) {
+                            parent[to] = from;
+                            parent_key[to] = KEYS[d];
+                            queue[tail++] = to;
+                        }
+                    }
+                }
+            }
+            if (parent[target] < 0) {
+                return "";
+            }
+            std::string keys;
+            for (int k = target; k != start; k = parent[k]) {
+                keys += parent_key[k];
+            }
+            std::reverse(keys.begin(), keys.end());
+            keys += ' ';
+            direction_6::Enum directions[NUM_HOLE];
+            const position pos = get_position();
+            const int length = pos.path(m, directions);
+            if (length == 0) {
+                return "";
+            }
+            for (int k = 0; k < length; k++) {
+                keys += KEYS[directions[k]];
+            }
+            // a hop over a far piece is reached by pressing twice when a single step is possible
+            const int neighbor = g.ray_length[m.from][directions[0]] > 0 ? g.ray[m.from][directions[0]][0] : -1;
+            if (neighbor != m.to && neighbor >= 0 && pos.empty(neighbor)) {
+                keys.insert(keys.end() - length, KEYS[directions[0]]);
+            }
+            keys += ' ';
+            return keys;
+        }
+
+        // print board
+        void print() {
+            system("clear");
+            for (int i = 0; i < M; i++) {
+                for (int j = 0; j < N; j++) {
+                    char& c = at(i, j);
+                    if (c == CHAR_NONE) {
+                        std::cout << " ";
+                    } else if (c == CHAR_EMPTY) {
+                        std::cout << "\e[37m\u2b24\e[0m";
+                    } else if (c == CHAR_PLAYER[0]) {
+                        if (i == current_i && j == current_j) {
+                            std::cout << "\e[91m\u2b24\e[0m";
+                        } else {
+                            std::cout << "\e[31m\u2b24\e[0m";
+                        }
+                    } else if (c == CHAR_PLAYER[1]) {
+                        if (i == current_i && j == current_j) {
+                            std::cout << "\e[92m\u2b24\e[0m";
+                        } else {
+                            std::cout << "\e[32m\u2b24\e[0m";
+                        }
+                    }
+                }
+                std::cout << std::endl;
+            }
+        }
+
+    private:
+        // set no optional location
+        inline void no_optional() { optional_i = -1; }
+
+        // return true if there is optional location
+        inline bool has_optional() { return optional_i >= 0; }
+
+        // replay moves
+        void replay() {
+            int stored_current_i = current_i;
+            int stored_current_j = current_j;
+            char char_player = CHAR_PLAYER[current_player];
+            at(current_i, current_j) = CHAR_EMPTY;
+            for (const std::pair<int, int>& p: trace) {
+                current_i = p.first;
+                current_j = p.second;
+                at(current_i, current_j) = char_player;
+                print();
+                std::cout << "Replaying...\n";
+                std::this_thread::sleep_for (std::chrono::milliseconds(500));
+                at(current_i, current_j) = CHAR_EMPTY;
+            }
+            current_i = stored_current_i;
+            current_j = stored_current_j;
+            at(current_i, current_j) = char_player;
+        }
+
+        // move current location to (i, j)
+        void move_to(int i, int j) {
+            std::swap(at(current_i, current_j), at(i, j));
+            current_i = i;
+            current_j = j;
+        }
+
+        // base template class to provide movement and check for different direction
+        template <direction_6::Enum Direction>
+            class iterator {
+                public:
+                    void set(int v1_i, int v1_j, int v2_i, int v2_j) {
+                        this->v1_i = v1_i;
+                        this->v1_j = v1_j;
+                        this->v2_i = v2_i;
+                        this->v2_j = v2_j;
+                    }
+
+                    int get_i() { return v1_i; }
+
+                    int get_j() { return v1_j; }
+
+                    template <direction_6::Enum _Direction = Direction, typename std::enable_if<_Direction == direction_6::LEFT, int>::type = 0>
+                        int get_init_end_i() { return 0; }
+
+                    template <direction_6::Enum _Direction = Direction, typename std::enable_if<_Direction == direction_6::LEFT, int>::type = 0>
+                        int get_init_end_j() { return 0; }
+
+                    template <direction_6::Enum _Direction = Direction, typename std::enable_if<_Direction == direction_6::LEFT, int>::type = 0>
+                        bool has_next() { return v1_j >= v2_j; }
+
+                    template <direction_6::Enum _Direction = Direction, typename std::enable_if<_Direction == direction_6::LEFT, int>::type = 0>
+                        void next() { v1_j -= 2; }
+
+                    template <direction_6::Enum _Direction = Direction, typename std::enable_if<_Direction == direction_6::LEFT, int>::type = 0>
+                        void get_target() { v1_j = v2_j - (v1_j - v2_j); }
+
+                    template <direction_6::Enum _Direction = Direction, typename std::enable_if<_Direction == direction_6::LEFT, int>::type = 0>
+                        bool target_out_of_bound() { return v1_j < 0; }
+
+                    template <direction_6::Enum _Direction = Direction, typename std::enable_if<_Direction == direction_6::RIGHT, int>::type = 0>
+                        int get_init_end_i() { return 0; }
+
+                    template <direction_6::Enum _Direction = Direction, typename std::enable_if<_Direction == direction_6::RIGHT, int>::type = 0>
+                        int get_init_end_j() { return ::N - 1; }
+
+                    template <direction_6::Enum _Direction = Direction, typename std::enable_if<_Direction == direction_6::RIGHT, int>::type = 0>
+                        bool has_next() { return v1_j <= v2_j; }
+
+                    template <direction_6::Enum _Direction = Direction, typename std::enable_if<_Direction == direction_6::RIGHT, int>::type = 0>
+                        void next() { v1_j += 2; }
+
+                    template <direction_6::Enum _Direction = Direction, typename std::enable_if<_Direction == direction_6::RIGHT, int>::type = 0>
+                        void get_target() { v1_j = v2_j + (v2_j - v1_j); }
+
+                    template <direction_6::Enum _Direction = Direction, typename std::enable_if<_Direction == direction_6::RIGHT, int>::type = 0>
+                        bool target_out_of_bound() { return v1_j >= ::N; }
+
+                    template <direction_6::Enum _Direction = Direction, typename std::enable_if<_Direction == direction_6::LEFT_UP, int>::type = 0>
+                        int get_init_end_i() { return 0; }
+
+                    template <direction_6::Enum _Direction = Direction, typename std::enable_if<_Direction == direction_6::LEFT_UP, int>::type = 0>
+                        int get_init_end_j() { return 0; }
+
+                    template <direction_6::Enum _Direction = Direction, typename std::enable_if<_Direction == direction_6::LEFT_UP, int>::type = 0>
+                        bool has_next() { return v1_i >= v2_i && v1_j >= v2_j; }
+
+                    template <direction_6::Enum _Direction = Direction, typename std::enable_if<_Direction == direction_6::LEFT_UP, int>::type = 0>
+                        void next() { v1_i--; v1_j--; }
+
+                    template <direction_6::Enum _Direction = Direction, typename std::enable_if<_Direction == direction_6::LEFT_UP, int>::type = 0>
+                        void get_target() { v1_i = v2_i - (v1_i - v2_i); v1_j = v2_j - (v1_j - v2_j); }
+
+                    template <direction_6::Enum _Direction = Direction, typename std::enable_if<_Direction == direction_6::LEFT_UP, int>::type = 0>
+                        bool target_out_of_bound() { return v1_i < 0 || v1_j < 0; }
+
+                    template <direction_6::Enum _Direction = Direction, typename std::enable_if<_Direction == direction_6::RIGHT_UP, int>::type = 0>
+                        int get_init_end_i() { return 0; }
+
+                    template <direction_6::Enum _Direction = Direction, typename std::enable_if<_Direction == direction_6::RIGHT_UP, int>::type = 0>
+                        int get_init_end_j() { return ::N - 1; }
+
+                    template <direction_6::Enum _Direction = Direction, typename std::enable_if<_Direction == direction_6::RIGHT_UP, int>::type = 0>
+                        bool has_next() { return v1_i >= v2_i && v1_j <= v2_j; }
+
+                    template <direction_6::Enum _Direction = Direction, typename std::enable_if<_Direction == direction_6::RIGHT_UP, int>::type = 0>
+                        void next() { v1_i--; v1_j++; }
+
+                    template <direction_6::Enum _Direction = Direction, typename std::enable_if<_Direction == direction_6::RIGHT_UP, int>::type = 0>
+                        void get_target() { v1_i = v2_i - (v1_i - v2_i); v1_j = v2_j + (v2_j - v1_j); }
+
+                    template <direction_6::Enum _Direction = Direction, typename std::enable_if<_Direction == direction_6::RIGHT_UP, int>::type = 0>
+                        bool target_out_of_bound() { return v1_i < 0 || v1_j >= ::N; }
+
+                    template <direction_6::Enum _Direction = Direction, typename std::enable_if<_Direction == direction_6::LEFT_DOWN, int>::type = 0>
+                        int get_init_end_i() { return ::M - 1; }
+
+                    template <direction_6::Enum _Direction = Direction, typename std::enable_if<_Direction == direction_6::LEFT_DOWN, int>::type = 0>
+                        int get_init_end_j() { return 0; }
+
+                    template <direction_6::Enum _Direction = Direction, typename std::enable_if<_Direction == direction_6::LEFT_DOWN, int>::type = 0>
+                        bool has_next() { return v1_i <= v2_i && v1_j >= v2_j; }
+
+                    template <direction_6::Enum _Direction = Direction, typename std::enable_if<_Direction == direction_6::LEFT_DOWN, int>::type = 0>
+                        void next() { v1_i++; v1_j--; }
+
+                    template <direction_6::Enum _Direction = Direction, typename std::enable_if<_Direction == direction_6::LEFT_DOWN, int>::type = 0>
+                        void get_target() { v1_i = v2_i + (v2_i - v1_i); v1_j = v2_j - (v1_j - v2_j); }
+
+                    template <direction_6::Enum _Direction = Direction, typename std::enable_if<_Direction == direction_6::LEFT_DOWN, int>::type = 0>
+                        bool target_out_of_bound() { return v1_i >= ::M || v1_j < 0; }
+
+                    template <direction_6::Enum _Direction = Direction, typename std::enable_if<_Direction == direction_6::RIGHT_DOWN, int>::type = 0>
+                        int get_init_end_i() { return ::M - 1; }
+
+                    template <direction_6::Enum _Direction = Direction, typename std::enable_if<_Direction == direction_6::RIGHT_DOWN, int>::type = 0>
+                        int get_init_end_j() { return ::N - 1; }
+
+                    template <direction_6::Enum _Direction = Direction, typename std::enable_if<_Direction == direction_6::RIGHT_DOWN, int>::type = 0>
+                        bool has_next() { return v1_i <= v2_i && v1_j <= v2_j; }
+
+                    template <direction_6::Enum _Direction = Direction, typename std::enable_if<_Direction == direction_6::RIGHT_DOWN, int>::type = 0>
+                        void next() { v1_i++; v1_j++; }
+
+                    template <direction_6::Enum _Direction = Direction, typename std::enable_if<_Direction == direction_6::RIGHT_DOWN, int>::type = 0>
+                        void get_target() { v1_i = v2_i + (v2_i - v1_i); v1_j = v2_j + (v2_j - v1_j); }
+
+                    template <direction_6::Enum _Direction = Direction, typename std::enable_if<_Direction == direction_6::RIGHT_DOWN, int>::type = 0>
+                        bool target_out_of_bound() { return v1_i >= ::M || v1_j >= ::N; }
+                private:
+                    int v1_i;
+                    int v1_j;
+                    int v2_i;
+                    int v2_j;
+            };
+
+        // move one step towards direction
+        template <direction_6::Enum Direction>
+            bool move_by_one(int& current_i, int& current_j, int& planned_i, int& planned_j, iterator<Direction>& it) {
+                it.set(current_i, current_j, it.get_init_end_i(), it.get_init_end_j());
+                it.next();
+                if (it.has_next()) {
+                    planned_i = it.get_i();
+                    planned_j = it.get_j();
+                    return true;
+                }
+                return false;
+            }
+
+        // try hop towards direction, return true if the plan is in board
+        template <direction_6::Enum Direction>
+            bool try_hop(int& planned_i, int& planned_j, bool& is_one_step) {
+                char char_in_board;
+                bool found = false;
+                bool blocked = false;
+                int target_i;
+                int target_j;
+                int bridge_i;
+                int bridge_j;
+                iterator<Direction> it;
+                it.set(current_i, current_j, it.get_init_end_i(), it.get_init_end_j());
+                while (it.next(), it.has_next()) {
+                    bridge_i = it.get_i();
+                    bridge_j = it.get_j();
+                    char_in_board = at(bridge_i, bridge_j);
+                    if (char_in_board == CHAR_NONE) {
+                        break;
+                    } else if (char_in_board != CHAR_EMPTY) {
+                        found = true;
+                        break;
+                    }
+                }
+                if (!found) {
+                    no_optional();
+                    is_one_step = true;
+                    return move_by_one<Direction>(current_i, current_j, planned_i, planned_j, it);
+                }
+
+                // assertion:
+                // (bridge_i, bridge_j) closer to edge of board than (current_i, current_j)
+                // (bridge_i, bridge_i) not at edge of board -> move_by_one returns true
+                it.set(current_i, current_j, bridge_i, bridge_j);
+                it.get_target();
+                target_i = it.get_i();
+                target_j = it.get_j();
+                if (it.target_out_of_bound() || at(target_i, target_j) == CHAR_NONE) {
+                    no_optional();
+                    is_one_step = true;
+                    return move_by_one<Direction>(current_i, current_j, planned_i, planned_j, it);
+                }
+
+                // assertion:
+                // (target_i, target_j) closer to edge of board than (bridge_i, bridge_j)
+                // (target_i, target_j) not out of board
+                it.set(bridge_i, bridge_j, target_i, target_j);
+                while (it.next(), it.has_next()) {
+                    planned_i = it.get_i();
+                    planned_j = it.get_j();
+                    if (at(planned_i, planned_j) != CHAR_EMPTY) {
+                        blocked = true;
+                        break;
+                    }
+                }
+                if (blocked) {
+                    no_optional();
+                    is_one_step = true;
+                    return move_by_one<Direction>(current_i, current_j, planned_i, planned_j, it);
+                }
+
+                // assertion:
+                // (bridge_i, bridge_j) to (target_i, target_j) not blocked
+                planned_i = target_i;
+                planned_j = target_j;
+                return move_by_one<Direction>(current_i, current_j, optional_i, optional_j, it);
+            }
+
+        // move when selected
+        bool move_selected(direction_6::Enum direct) {
+            int planned_i;
+            int planned_j;
+            bool is_one_step = false;
+            bool in_bound;
+            switch(direct) {
+                case direction_6::LEFT:
+                    in_bound = try_hop<direction_6::LEFT>(planned_i, planned_j, is_one_step);
+                    break;
+                case direction_6::RIGHT:
+                    in_bound = try_hop<direction_6::RIGHT>(planned_i, planned_j, is_one_step);
+                    break;
+                case direction_6::LEFT_UP:
+                    in_bound = try_hop<direction_6::LEFT_UP>(planned_i, planned_j, is_one_step);
+                    break;
+                case direction_6::RIGHT_UP:
+                    in_bound = try_hop<direction_6::RIGHT_UP>(planned_i, planned_j, is_one_step);
+                    break;
+                case direction_6::LEFT_DOWN:
+                    in_bound = try_hop<direction_6::LEFT_DOWN>(planned_i, planned_j, is_one_step);
+                    break;
+                case direction_6::RIGHT_DOWN:
+                    in_bound = try_hop<direction_6::RIGHT_DOWN>(planned_i, planned_j, is_one_step);
+                    break;
+            }
+            if (in_bound && (at(planned_i, planned_j) == CHAR_EMPTY)) {
+                if (trace.empty()) { // No move yet
+                    move_type = is_one_step ? SINGLE_STEP : HOP;
+                    if (move_type == HOP) {
+                        if (at(optional_i, optional_j) == CHAR_EMPTY) {
+                            std::swap(planned_i, optional_i);
+                            std::swap(planned_j, optional_j);
+                            move_type = SINGLE_STEP;
+                        } else {
+                            no_optional();
+                        }
+                    }
+                    trace.push_back(std::make_pair(current_i, current_j));
+                    move_to(planned_i, planned_j);
+                    return true;
+                } else if (move_type == SINGLE_STEP) {
+                    // If was single step, allow going back only
+                    const std::pair<int, int>& last_pos = trace.back();
+                    if (is_one_step) {
+                        if (last_pos.first == planned_i && last_pos.second == planned_j) {
+                            trace.pop_back();
+                            move_to(planned_i, planned_j);
+                            return true;
+                        }
+                    } else {
+                        if (last_pos.first == optional_i && last_pos.second == optional_j) {
+                            trace.pop_back();
+                            move_to(optional_i, optional_j);
+                            no_optional();
+                            return true;
+                        }
+                    }
+                } else if (!is_one_step) {
+                    if (!trim_trace_if_exists(planned_i, planned_j)) {
+                        trace.push_back(std::make_pair(current_i, current_j));
+                    }
+                    move_to(planned_i, planned_j);
+                    no_optional();
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        // move when not selected
+        void move_unselected(direction_6::Enum direct) {
+            int planned_i;
+            int planned_j;
+            if (find_unselected(direct, current_i, current_j, planned_i, planned_j)) {
+                current_i = planned_i;
+                current_j = planned_j;
+            }
+        }
+
+        // find piece of current player from (from_i, from_j) towards direction, return true if found
+        bool find_unselected(direction_6::Enum direct, int from_i, int from_j, int& planned_i, int& planned_j) {
+            planned_i = from_i;
+            planned_j = from_j;
+            char char_player = CHAR_PLAYER[current_player];
+            char char_in_board = CHAR_NONE;
+            bool found = false;
+            switch(direct) {
+                case direction_6::LEFT:
+                    for (planned_j -= 2; planned_j >= 0; planned_j -= 2) {
+                        char_in_board = at(planned_i, planned_j);
+                        if (char_in_board == char_player) {
+                            found = true;
+                            break;
+                        } else if (char_in_board == CHAR_NONE) {
+                            break;
+                        }
+                    }
+                    break;
+                case direction_6::RIGHT:
+                    for (planned_j += 2; planned_j < N; planned_j += 2) {
+                        char_in_board = at(planned_i, planned_j);
+                        if (char_in_board == char_player) {
+                            found = true;
+                            break;
+                        } else if (char_in_board == CHAR_NONE) {
+                            break;
+                        }
+                    }
+                    break;
+                case direction_6::LEFT_UP:
+                    for (planned_i--; planned_i >= 0; planned_i--) {
+                        for (planned_j -= ((from_i - planned_i) & 1); planned_j >= 0; planned_j -= 2) {
+                            char_in_board = at(planned_i, planned_j);
+                            if (char_in_board == char_player) {
+                                found = true;
+                                break;
+                            }
+                        }
+                        if (found) {
+                            break;
+                        }
+                        planned_j = from_j;
+                    }
+                    break;
+                case direction_6::RIGHT_UP:
+                    for (planned_i--; planned_i >= 0; planned_i--) {
+                        for (planned_j += ((from_i - planned_i) & 1); planned_j < N; planned_j += 2) {
+                            char_in_board = at(planned_i, planned_j);
+                            if (char_in_board == char_player) {
+                                found = true;
+                                break;
+                            }
+                        }
+                        if (found) {
+                            break;
+                        }
+                        planned_j = from_j;
+                    }
+                    break;
+                case direction_6::LEFT_DOWN:
+                    for (planned_i++; planned_i < M; planned_i++) {
+                        for (planned_j -= ((planned_i - from_i) & 1); planned_j >= 0; planned_j -= 2) {
+                            char_in_board = at(planned_i, planned_j);
+                            if (char_in_board == char_player) {
+                                found = true;
+                                break;
+                            }
+                        }
+                        if (found) {
+                            break;
+                        }
+                        planned_j = from_j;
+                    }
+                    break;
+                case direction_6::RIGHT_DOWN:
+                    for (planned_i++; planned_i < M; planned_i++) {
+                        for (planned_j += ((planned_i - from_i) & 1); planned_j < N; planned_j += 2) {
+                            char_in_board = at(planned_i, planned_j);
+                            if (char_in_board == char_player) {
+                                found = true;
+                                break;
+                            }
+                        }
+                        if (found) {
+                            break;
+                        }
+                        planned_j = from_j;
+                    }
+                    break;
+            }
+            return found;
+        }
+
+        // check if wins from top
+        bool check_win_from_top() {
+            char c = CHAR_PLAYER[current_player];
+            for (int i = 0; i < 4; i++) {
+                const int max_j = 12 + i;
+                for (int j = 12 - i; j <= max_j; j += 2) {
+                    if (at(i, j) != c) {
+                        return false;
+                    }
+                }
+            }
+            return true;
+        }
+
+        // check if wins from bottom
+        bool check_win_from_bottom() {
+            char c = CHAR_PLAYER[current_player];
+            for (int i = M - 4; i < M; i++) {
+                const int max_j = 12 + (M - i - 1);
+                for (int j = 12 - (M - i - 1); j <= max_j; j += 2) {
+                    if (at(i, j) != c) {
+                        return false;
+                    }
+                }
+            }
+            return true;
+        }
+
+        // trim trace if plan exists, return true if plan exists
+        bool trim_trace_if_exists(int planned_i, int planned_j) {
+            for (int i = 0; i < trace.size(); i++) {
+                if (trace[i].first == planned_i && trace[i].second == planned_j) {
+                    while (trace.back().first != planned_i && trace.back().second != planned_j) {
+                        trace.pop_back();
+                    }
+                    trace.pop_back();
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        // find from top
+        void find_from_top() {
+            char char_player = CHAR_PLAYER[current_player];
+            for (int i = 0; i < MN; i++) {
+                if (brd[i] == char_player) {
+                    current_i = i / N;
+                    current_j = i % N;
+                    break;
+                }
+            }
+        }
+
+        // find from bottom
+        void find_from_bottom() {
+            char char_player = CHAR_PLAYER[current_player];
+            for (int i = MN - 1; i > 0; i--) {
+                if (brd[i] == char_player) {
+                    current_i = i / N;
+                    current_j = i % N;
+                    break;
+                }
+            }
+        }
+
+        // Current move type
+        enum {
+            HOP, SINGLE_STEP
+        } move_type;
+
+        // current location is selected
+        bool selected;
+
+        // current player
+        int current_player;
+
+        // current location
+        int current_i;
+        int current_j;
+
+        // optional location, exists in HOP move
+        int optional_i;
+        int optional_j;
+
+        // last direction, used for HOP move
+        direction_6::Enum last_direction;
+
+        // previous location in order, used for replay
+        std::vector<std::pair<int, int> > trace;
+
+        // true if need swap
+        const bool need_swap;
+
+        // player of board
+        int my_player;
+};
+
+#endif
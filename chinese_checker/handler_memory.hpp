@@ -0,0 +1,105 @@
+#ifndef HANDLER_MEMORY_HPP
+#define HANDLER_MEMORY_HPP
+
+#include <atomic>      // atomic
+#include <cstddef>     // size_t
+#include <new>         // operator new, operator delete
+#include <type_traits> // aligned_storage
+#include <utility>     // forward
+
+// Memory for the handler of one asynchronous operation at a time, and for
+// the smaller operation a strand posts to run it when the strand was idle.
+// An operation that starts while the memory is taken falls back to the heap.
+// The blocks may be taken on one thread and given back on another.
+class handler_memory {
+    public:
+        handler_memory(): in_use(false), invoker_in_use(false) {}
+
+        handler_memory(const handler_memory&) = delete;
+        handler_memory& operator=(const handler_memory&) = delete;
+
+        void* allocate(std::size_t size) {
+            if (size <= sizeof(storage) && !in_use.exchange(true, std::memory_order_acquire)) {
+                return &storage;
+            }
+            if (size <= sizeof(invoker) && !invoker_in_use.exchange(true, std::memory_order_acquire)) {
+                return &invoker;
+            }
+            return ::operator new(size);
+        }
+
+        void deallocate(void* p) {
+            if (p == &storage) {
+                in_use.store(false, std::memory_order_release);
+            } else if (p == &invoker) {
+                invoker_in_use.store(false, std::memory_order_release);
+            } else {
+                ::operator delete(p);
+            }
+        }
+    private:
+        typename std::aligned_storage<256>::type storage;
+        typename std::aligned_storage<128>::type invoker;
+        std::atomic<bool> in_use;
+        std::atomic<bool> invoker_in_use;
+};
+
+// allocator handing out memory of a handler_memory
+template <typename T>
+class handler_allocator {
+    public:
+        typedef T value_type;
+
+        explicit handler_allocator(handler_memory& memory): memory(memory) {}
+
+        template <typename U>
+        handler_allocator(const handler_allocator<U>& other) noexcept: memory(other.memory) {}
+
+        bool operator==(const handler_allocator& other) const noexcept {
+            return &memory == &other.memory;
+        }
+
+        bool operator!=(const handler_allocator& other) const noexcept {
+            return &memory != &other.memory;
+        }
+
+        T* allocate(std::size_t n) const {
+            return static_cast<T*>(memory.allocate(sizeof(T) * n));
+        }
+
+        void deallocate(T* p, std::size_t) const {
+            memory.deallocate(p);
+        }
+    private:
+        template <typename> friend class handler_allocator;
+
+        handler_memory& memory;
+};
+
+// handler whose operation is allocated from memory
+template <typename Handler>
+class custom_alloc_handler {
+    public:
+        typedef handler_allocator<Handler> allocator_type;
+
+        custom_alloc_handler(handler_memory& memory, Handler handler): memory(memory), handler(handler) {}
+
+        allocator_type get_allocator() const noexcept {
+            return allocator_type(memory);
+        }
+
+        template <typename... Args>
+        void operator()(Args&&... args) {
+            handler(std::forward<Args>(args)...);
+        }
+    private:
+        handler_memory& memory;
+        Handler handler;
+};
+
+template <typename Handler>
+inline custom_alloc_handler<Handler> make_custom_alloc_handler(handler_memory& memory, Handler handler) {
+    return custom_alloc_handler<Handler>(memory, handler);
+}
+
+#endif
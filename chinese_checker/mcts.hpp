@@ -0,0 +1,259 @@
+#ifndef MCTS_HPP
+#define MCTS_HPP
+
+#include <atomic>    // atomic
+#include <chrono>    // milliseconds
+#include <cmath>     // sqrt, log, exp
+#include <cstdint>   // uint32_t, uint64_t
+#include <memory>    // unique_ptr
+#include <thread>    // thread
+#include <vector>    // vector
+
+#include "position.hpp"
+#include "search.hpp"
+
+// Monte Carlo tree search with UCT and progressive bias from the distance
+// heuristic. Threads share one tree, a selected path is charged a virtual
+// loss until its playout is backed up so threads spread over the tree.
+class mcts_engine: public engine {
+    public:
+        mcts_engine(int threads, int milliseconds, int arena_size = DEFAULT_ARENA_SIZE):
+            threads(threads), milliseconds(milliseconds), arena_size(arena_size), arena(new node[arena_size]) {}
+
+        move think(const position& pos) {
+            reset(pos);
+            stop.store(false);
+            std::vector<std::thread> workers;
+            for (int t = 0; t < threads; t++) {
+                workers.emplace_back(&mcts_engine::work, this, pos, (uint64_t)t + 1);
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(milliseconds));
+            stop.store(true);
+            for (std::thread& worker: workers) {
+                worker.join();
+            }
+            const node& root = arena[0];
+            move best = {0, 0};
+            int best_visits = -1;
+            for (uint32_t k = 0; k < root.child_count; k++) {
+                const node& child = arena[root.first_child + k];
+                const int visits = child.visits.load(std::memory_order_relaxed);
+                if (visits > best_visits) {
+                    best_visits = visits;
+                    best = child.m;
+                }
+            }
+            return best;
+        }
+    private:
+        static constexpr int DEFAULT_ARENA_SIZE = 1 << 21;
+        static constexpr int MAX_TREE_DEPTH = 128;
+        static constexpr int PLAYOUT_DEPTH = 12;
+        static constexpr int PLAYOUT_PIECES = 2;
+        static constexpr double EVALUATION_SCALE = 8.0;
+        static constexpr int EXPAND_VISITS = 8;
+        static constexpr int VIRTUAL_LOSS = 3;
+        static constexpr int VALUE_SCALE = 1024;
+        static constexpr double EXPLORATION = 0.7;
+        static constexpr double BIAS = 2.0;
+
+        enum {
+            LEAF, EXPANDING, EXPANDED
+        };
+
+        struct node {
+            move m;
+            float prior;
+            uint32_t first_child;
+            uint32_t child_count;
+            std::atomic<int> state;
+            std::atomic<int> visits;
+            // sum of rewards for the side that played m, scaled by VALUE_SCALE
+            std::atomic<int64_t> value;
+
+            void init(const move& m, float prior) {
+                this->m = m;
+                this->prior = prior;
+                first_child = 0;
+                child_count = 0;
+                state.store(LEAF, std::memory_order_relaxed);
+                visits.store(0, std::memory_order_relaxed);
+                value.store(0, std::memory_order_relaxed);
+            }
+        };
+
+        // reuse the arena for a new search from pos
+        void reset(const position& pos) {
+            move none = {0, 0};
+            next.store(1);
+            arena[0].init(none, 0);
+            expand(arena[0], pos);
+        }
+
+        // allocate children of n, return false if the arena is full
+        bool expand(node& n, const position& pos) {
+            move moves[MAX_MOVES];
+            const int count = pos.generate(moves);
+            if (next.load(std::memory_order_relaxed) + count > (uint32_t)arena_size) {
+                return false;
+            }
+            const uint32_t first = next.fetch_add(count);
+            if (first + count > (uint32_t)arena_size) {
+                return false;
+            }
+            int best_gain = 1;
+            for (int k = 0; k < count; k++) {
+                const int gain = pos.gain(moves[k]);
+                if (gain > best_gain) {
+                    best_gain = gain;
+                }
+            }
+            for (int k = 0; k < count; k++) {
+                const int gain = pos.gain(moves[k]);
+                arena[first + k].init(moves[k], gain > 0 ? (float)gain / best_gain : 0);
+            }
+            n.first_child = first;
+            n.child_count = count;
+            n.state.store(EXPANDED, std::memory_order_release);
+            return true;
+        }
+
+        // child maximizing UCT score plus progressive bias
+        node& select(node& n) {
+            const int parent_visits = n.visits.load(std::memory_order_relaxed);
+            const double log_visits = std::log((double)parent_visits + 1);
+            node* best = &arena[n.first_child];
+            double best_score = -1;
+            for (uint32_t k = 0; k < n.child_count; k++) {
+                node& child = arena[n.first_child + k];
+                const int visits = child.visits.load(std::memory_order_relaxed);
+                double score;
+                if (visits == 0) {
+                    score = 1 + EXPLORATION + BIAS * child.prior;
+                } else {
+                    const double mean = (double)child.value.load(std::memory_order_relaxed) / VALUE_SCALE / visits;
+                    score = mean + EXPLORATION * std::sqrt(log_visits / visits) + BIAS * child.prior / (visits + 1);
+                }
+                if (score > best_score) {
+                    best_score = score;
+                    best = &child;
+                }
+            }
+            return *best;
+        }
+
+        void work(position root, uint64_t seed) {
+            node* path[MAX_TREE_DEPTH];
+            uint64_t rng = seed * 0x9e3779b97f4a7c15ULL;
+            while (!stop.load(std::memory_order_relaxed)) {
+                position pos = root;
+                node* n = &arena[0];
+                int depth = 0;
+                path[depth++] = n;
+                n->visits.fetch_add(VIRTUAL_LOSS, std::memory_order_relaxed);
+                while (depth < MAX_TREE_DEPTH && !pos.finished(1 - pos.side_to_move())) {
+                    if (n->state.load(std::memory_order_acquire) != EXPANDED) {
+                        int expected = LEAF;
+                        if (n->visits.load(std::memory_order_relaxed) < EXPAND_VISITS ||
+                                !n->state.compare_exchange_strong(expected, EXPANDING) ||
+                                !expand(*n, pos)) {
+                            break;
+                        }
+                    }
+                    if (n->child_count == 0) {
+                        break;
+                    }
+                    n = &select(*n);
+                    n->visits.fetch_add(VIRTUAL_LOSS, std::memory_order_relaxed);
+                    pos.play(n->m);
+                    path[depth++] = n;
+                }
+                const int result = playout(pos, rng);
+                // reward of the side that played the move into each node
+                int side = root.side_to_move();
+                for (int k = 1; k < depth; k++) {
+                    node* p = path[k];
+                    p->value.fetch_add(side == 0 ? result : VALUE_SCALE - result, std::memory_order_relaxed);
+                    p->visits.fetch_sub(VIRTUAL_LOSS - 1, std::memory_order_relaxed);
+                    side = 1 - side;
+                }
+                path[0]->visits.fetch_sub(VIRTUAL_LOSS - 1, std::memory_order_relaxed);
+            }
+        }
+
+        // truncated playout, return chance of side 0 winning scaled by VALUE_SCALE. Each ply
+        // moves the most advancing of a few random pieces, by a single step or a greedy hop chain.
+        static int playout(position& pos, uint64_t& rng) {
+            const position::geometry& g = position::geo();
+            for (int ply = 0; ply < PLAYOUT_DEPTH; ply++) {
+                if (pos.finished(0)) {
+                    return VALUE_SCALE;
+                } else if (pos.finished(1)) {
+                    return 0;
+                }
+                const int side = pos.side_to_move();
+                const int* distance = g.goal_distance[side];
+                move best = {0, 0};
+                int best_gain = -NUM_HOLE;
+                const int start = next_random(rng) % NUM_PIECE;
+                for (int tried = 0; tried < NUM_PIECE; tried++) {
+                    const int from = pos.pieces(side)[(start + tried) % NUM_PIECE];
+                    for (int d = 0; d < NUM_DIRECTION; d++) {
+                        if (g.ray_length[from][d] > 0 && pos.empty(g.ray[from][d][0])) {
+                            const int to = g.ray[from][d][0];
+                            const int gain = distance[from] - distance[to];
+                            if (gain > best_gain || (gain == best_gain && (next_random(rng) & 1))) {
+                                best_gain = gain;
+                                best.from = from;
+                                best.to = to;
+                            }
+                        }
+                    }
+                    int h = from;
+                    while (true) {
+                        int next = -1;
+                        for (int d = 0; d < NUM_DIRECTION; d++) {
+                            const int t = pos.hop(from, h, d);
+                            if (t >= 0 && distance[t] < (next < 0 ? distance[h] : distance[next])) {
+                                next = t;
+                            }
+                        }
+                        if (next < 0) {
+                            break;
+                        }
+                        h = next;
+                    }
+                    if (h != from && distance[from] - distance[h] >= best_gain) {
+                        best_gain = distance[from] - distance[h];
+                        best.from = from;
+                        best.to = h;
+                    }
+                    if (best_gain > 0 && tried >= PLAYOUT_PIECES) {
+                        break;
+                    }
+                }
+                if (best_gain == -NUM_HOLE) {
+                    break;
+                }
+                pos.play(best);
+            }
+            const double diff = pos.get_distance(1) - pos.get_distance(0);
+            return (int)(VALUE_SCALE / (1 + std::exp(-diff / EVALUATION_SCALE)));
+        }
+
+        static uint64_t next_random(uint64_t& rng) {
+            rng ^= rng << 13;
+            rng ^= rng >> 7;
+            rng ^= rng << 17;
+            return rng;
+        }
+
+        const int threads;
+        const int milliseconds;
+        const int arena_size;
+        std::unique_ptr<node[]> arena;
+        std::atomic<uint32_t> next;
+        std::atomic<bool> stop;
+};
+
+#endif
@@ -0,0 +1,129 @@
+#ifndef METRICS_HPP
+#define METRICS_HPP
+
+#include <atomic>  // atomic
+#include <chrono>  // steady_clock, microseconds
+#include <cstdint> // int64_t, uint64_t
+#include <string>  // string, to_string
+
+// Server counters and a latency histogram. Every thread adds to its own
+// stripe with relaxed atomics so updates never contend, reads sum the
+// stripes and may be slightly behind.
+class metrics {
+    public:
+        enum counter {
+            ACCEPTED,
+            REJECTED,
+            HANDED_OFF,
+            SESSIONS,
+            ROOMS,
+            SPECTATORS,
+            SLOW_DROPPED,
+            SHED_LOGINS,
+            MATCHES,
+            WAITING,
+            TURN_DROPPED,
+            PUT_MESSAGES,
+            IN_MESSAGES,
+            MATCH_MESSAGES,
+            OUT_MESSAGES,
+            BAD_MESSAGES,
+            BYTES_IN,
+            BYTES_OUT,
+            NUM_COUNTERS
+        };
+
+        // latency buckets by powers of two microseconds, the last one is unbounded
+        static constexpr int NUM_BUCKETS = 24;
+
+        metrics() {
+            for (int s = 0; s < NUM_STRIPES; s++) {
+                for (int c = 0; c < NUM_COUNTERS; c++) {
+                    stripes[s].counters[c].store(0, std::memory_order_relaxed);
+                }
+                for (int b = 0; b < NUM_BUCKETS; b++) {
+                    stripes[s].buckets[b].store(0, std::memory_order_relaxed);
+                }
+                stripes[s].latency_sum.store(0, std::memory_order_relaxed);
+            }
+        }
+
+        void add(counter c, int64_t n = 1) {
+            local_stripe().counters[c].fetch_add(n, std::memory_order_relaxed);
+        }
+
+        void record_latency(int64_t microseconds) {
+            stripe& s = local_stripe();
+            s.buckets[bucket(microseconds)].fetch_add(1, std::memory_order_relaxed);
+            s.latency_sum.fetch_add(microseconds, std::memory_order_relaxed);
+        }
+
+        int64_t get(counter c) const {
+            int64_t sum = 0;
+            for (int s = 0; s < NUM_STRIPES; s++) {
+                sum += stripes[s].counters[c].load(std::memory_order_relaxed);
+            }
+            return sum;
+        }
+
+        // samples in bucket b, upper bound of bucket b is 2^b microseconds
+        int64_t get_bucket(int b) const {
+            int64_t sum = 0;
+            for (int s = 0; s < NUM_STRIPES; s++) {
+                sum += stripes[s].buckets[b].load(std::memory_order_relaxed);
+            }
+            return sum;
+        }
+
+        int64_t get_latency_sum() const {
+            int64_t sum = 0;
+            for (int s = 0; s < NUM_STRIPES; s++) {
+                sum += stripes[s].latency_sum.load(std::memory_order_relaxed);
+            }
+            return sum;
+        }
+
+        // latency histogram in Prometheus text format
+        std::string format_latency(const std::string& name) const {
+            std::string out = "# TYPE " + name + " histogram\n";
+            int64_t count = 0;
+            for (int b = 0; b < NUM_BUCKETS; b++) {
+                count += get_bucket(b);
+                const std::string bound = b == NUM_BUCKETS - 1 ? "+Inf" : std::to_string(1LL << b);
+                out += name + "_bucket{le=\"" + bound + "\"} " + std::to_string(count) + "\n";
+            }
+            out += name + "_sum " + std::to_string(get_latency_sum()) + "\n";
+            out += name + "_count " + std::to_string(count) + "\n";
+            return out;
+        }
+
+        static int64_t elapsed_microseconds(std::chrono::steady_clock::time_point since) {
+            return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - since).count();
+        }
+    private:
+        static constexpr int NUM_STRIPES = 64;
+
+        struct alignas(64) stripe {
+            std::atomic<int64_t> counters[NUM_COUNTERS];
+            std::atomic<int64_t> buckets[NUM_BUCKETS];
+            std::atomic<int64_t> latency_sum;
+        };
+
+        stripe& local_stripe() {
+            static std::atomic<int> next_stripe(0);
+            static thread_local int index = next_stripe.fetch_add(1) % NUM_STRIPES;
+            return stripes[index];
+        }
+
+        static int bucket(int64_t microseconds) {
+            int b = 0;
+            while (b < NUM_BUCKETS - 1 && (1LL << b) < microseconds) {
+                b++;
+            }
+            return b;
+        }
+
+        stripe stripes[NUM_STRIPES];
+};
+
+#endif
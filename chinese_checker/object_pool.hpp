@@ -0,0 +1,81 @@
+#ifndef OBJECT_POOL_HPP
+#define OBJECT_POOL_HPP
+
+#include <cstddef> // size_t
+#include <new>     // operator new, operator delete
+
+#include "lockable.hpp"
+
+// Free list of blocks of Size bytes shared by all threads. Blocks given back
+// are kept for the next allocation instead of going back to the heap.
+template <std::size_t Size>
+class block_pool: public lockable {
+    public:
+        static block_pool& instance() {
+            static block_pool pool;
+            return pool;
+        }
+
+        void* allocate() {
+            lock();
+            block* b = free_list;
+            if (b) {
+                free_list = b->next;
+            }
+            unlock();
+            return b ? b : ::operator new(Size < sizeof(block) ? sizeof(block) : Size);
+        }
+
+        void deallocate(void* p) {
+            block* b = static_cast<block*>(p);
+            ATOMIC_RUN(
+                    b->next = free_list;
+                    free_list = b;
+                    )
+        }
+    private:
+        struct block {
+            block* next;
+        };
+
+        block_pool(): free_list(nullptr) {}
+
+        block* free_list;
+};
+
+// allocator taking single objects from the block pool of their size
+template <typename T>
+class pool_allocator {
+    public:
+        typedef T value_type;
+
+        pool_allocator() noexcept {}
+
+        template <typename U>
+        pool_allocator(const pool_allocator<U>&) noexcept {}
+
+        bool operator==(const pool_allocator&) const noexcept {
+            return true;
+        }
+
+        bool operator!=(const pool_allocator&) const noexcept {
+            return false;
+        }
+
+        T* allocate(std::size_t n) const {
+            if (n == 1) {
+                return static_cast<T*>(block_pool<sizeof(T)>::instance().allocate());
+            }
+            return static_cast<T*>(::operator new(sizeof(T) * n));
+        }
+
+        void deallocate(T* p, std::size_t n) const {
+            if (n == 1) {
+                block_pool<sizeof(T)>::instance().deallocate(p);
+            } else {
+                ::operator delete(p);
+            }
+        }
+};
+
+#endif
@@ -0,0 +1,361 @@
+#ifndef POSITION_HPP
+#define POSITION_HPP
+
+#include <cstdint>  // int8_t, uint8_t
+#include <cstdlib>  // abs
+#include <cstring>  // memset
+#include <string>   // string, to_string
+
+#include "board.hpp"
+#include "common.hpp"
+#include "direction.hpp"
+
+constexpr int NUM_HOLE = 121;
+constexpr int NUM_PIECE = 10;
+constexpr int NUM_DIRECTION = 6;
+constexpr int MAX_RAY = 16;
+constexpr int MAX_MOVES = NUM_PIECE * NUM_HOLE;
+
+// a move of one piece, either a single step or a chain of hops
+struct move {
+    uint8_t from;
+    uint8_t to;
+};
+
+// Compact position used by engines. Holes are numbered 0..120 in row major
+// order of the board, so rotating the board by 180 degrees maps hole h to
+// NUM_HOLE - 1 - h. Side 0 moves towards the top triangle (holes 0..9),
+// side 1 towards the bottom triangle (holes 111..120).
+class position {
+    public:
+        // board geometry shared by every position
+        struct geometry {
+            int row[NUM_HOLE];
+            int col[NUM_HOLE];
+            int hole[M * N];
+            int ray[NUM_HOLE][NUM_DIRECTION][MAX_RAY];
+            int ray_length[NUM_HOLE][NUM_DIRECTION];
+            int goal_distance[NUM_PLAYER][NUM_HOLE];
+            bool in_goal[NUM_PLAYER][NUM_HOLE];
+
+            geometry() {
+                static const int DELTA[NUM_DIRECTION][2] = {
+                    {0, -2}, {-1, -1}, {-1, 1}, {1, -1}, {1, 1}, {0, 2}
+                };
+                int h = 0;
+                for (int i = 0; i < M; i++) {
+                    for (int j = 0; j < N; j++) {
+                        if (INIT_BOARD[i * N + j] == CHAR_NONE) {
+                            hole[i * N + j] = -1;
+                        } else {
+                            row[h] = i;
+                            col[h] = j;
+                            hole[i * N + j] = h++;
+                        }
+                    }
+                }
+                for (h = 0; h < NUM_HOLE; h++) {
+                    for (int d = 0; d < NUM_DIRECTION; d++) {
+                        int length = 0;
+                        int i = row[h] + DELTA[d][0];
+                        int j = col[h] + DELTA[d][1];
+                        while (i >= 0 && i < M && j >= 0 && j < N && hole[i * N + j] >= 0) {
+                            ray[h][d][length++] = hole[i * N + j];
+                            i += DELTA[d][0];
+                            j += DELTA[d][1];
+                        }
+                        ray_length[h][d] = length;
+                    }
+                    // hex distance to the far tip of the goal triangle
+                    const int up_i = row[h];
+                    const int down_i = M - 1 - row[h];
+                    const int dj = std::abs(col[h] - N / 2);
+                    goal_distance[0][h] = up_i + (dj > up_i ? (dj - up_i) / 2 : 0);
+                    goal_distance[1][h] = down_i + (dj > down_i ? (dj - down_i) / 2 : 0);
+                    in_goal[0][h] = row[h] < 4;
+                    in_goal[1][h] = row[h] >= M - 4;
+                }
+            }
+        };
+
+        static const geometry& geo() {
+            static const geometry g;
+            return g;
+        }
+
+        // hole at board location (i, j), -1 if none
+        static int hole(int i, int j) {
+            return geo().hole[i * N + j];
+        }
+
+        // human readable hole name, row and hole in row counting from 1
+        static std::string name(int h) {
+            const geometry& g = geo();
+            int first = h;
+            while (first > 0 && g.row[first - 1] == g.row[h]) {
+                first--;
+            }
+            return "(" + std::to_string(g.row[h] + 1) + "," + std::to_string(h - first + 1) + ")";
+        }
+
+        // reset to the initial position, side 0 to move
+        void init() {
+            clear();
+            for (int k = 0; k < NUM_PIECE; k++) {
+                put(0, NUM_HOLE - 1 - k);
+                put(1, k);
+            }
+        }
+
+        // only side 0 on holes, or on its initial holes if null, for solo play
+        void solo(const uint8_t* holes = nullptr) {
+            clear();
+            for (int k = 0; k < NUM_PIECE; k++) {
+                put(0, holes ? holes[k] : NUM_HOLE - 1 - k);
+            }
+        }
+
+        // pieces of both sides on holes
+        void setup(const uint8_t* holes0, const uint8_t* holes1, int side_to_move) {
+            clear();
+            for (int k = 0; k < NUM_PIECE; k++) {
+                put(0, holes0[k]);
+                put(1, holes1[k]);
+            }
+            to_move = side_to_move;
+        }
+
+        // read position from board, up/down are the pieces moving towards top/bottom
+        void load(board<char>& brd, char up, char down, int side_to_move) {
+            clear();
+            for (int i = 0; i < M; i++) {
+                for (int j = 0; j < N; j++) {
+                    const int h = hole(i, j);
+                    if (h < 0) {
+                        continue;
+                    }
+                    const char c = brd.at(i, j);
+                    if (c == up) {
+                        put(0, h);
+                    } else if (c == down) {
+                        put(1, h);
+                    }
+                }
+            }
+            to_move = side_to_move;
+        }
+
+        // generate moves of side to move, return number of moves
+        int generate(move* moves) const {
+            uint8_t targets[NUM_HOLE];
+            int count = 0;
+            for (int k = 0; k < NUM_PIECE; k++) {
+                const int from = piece[to_move][k];
+                int n = destinations(from, targets);
+                for (int t = 0; t < n; t++) {
+                    moves[count].from = from;
+                    moves[count].to = targets[t];
+                    count++;
+                }
+            }
+            return count;
+        }
+
+        // holes reachable by piece at from, return number of holes
+        int destinations(int from, uint8_t* out) const {
+            const geometry& g = geo();
+            uint8_t reached[NUM_HOLE];
+            uint8_t queue[NUM_HOLE];
+            int count = 0;
+            memset(reached, 0, sizeof(reached));
+            reached[from] = 1;
+            for (int d = 0; d < NUM_DIRECTION; d++) {
+                if (g.ray_length[from][d] > 0 && cell[g.ray[from][d][0]] < 0) {
+                    out[count++] = g.ray[from][d][0];
+                    reached[g.ray[from][d][0]] = 2;
+                }
+            }
+            int head = 0;
+            int tail = 0;
+            queue[tail++] = from;
+            while (head < tail) {
+                const int h = queue[head++];
+                for (int d = 0; d < NUM_DIRECTION; d++) {
+                    const int t = hop(from, h, d);
+                    if (t >= 0 && reached[t] != 1) {
+                        if (reached[t] == 0) {
+                            out[count++] = t;
+                        }
+                        reached[t] = 1;
+                        queue[tail++] = t;
+                    }
+                }
+            }
+            return count;
+        }
+
+        // landing hole of a hop from h towards d with the moving piece lifted from from, -1 if none
+        int hop(int from, int h, int d) const {
+            const geometry& g = geo();
+            const int* ray = g.ray[h][d];
+            const int length = g.ray_length[h][d];
+            int bridge = 0;
+            while (bridge < length && (cell[ray[bridge]] < 0 || ray[bridge] == from)) {
+                bridge++;
+            }
+            const int target = 2 * bridge + 1;
+            if (target >= length) {
+                return -1;
+            }
+            for (int k = bridge + 1; k <= target; k++) {
+                if (cell[ray[k]] >= 0 && ray[k] != from) {
+                    return -1;
+                }
+            }
+            return ray[target];
+        }
+
+        // directions of the keys moving a piece along m, return number of directions
+        int path(const move& m, direction_6::Enum* directions) const {
+            const geometry& g = geo();
+            for (int d = 0; d < NUM_DIRECTION; d++) {
+                if (g.ray_length[m.from][d] > 0 && g.ray[m.from][d][0] == m.to && cell[m.to] < 0) {
+                    directions[0] = (direction_6::Enum)d;
+                    return 1;
+                }
+            }
+            int parent[NUM_HOLE];
+            int parent_direction[NUM_HOLE];
+            uint8_t queue[NUM_HOLE];
+            for (int h = 0; h < NUM_HOLE; h++) {
+                parent[h] = -1;
+            }
+            int head = 0;
+            int tail = 0;
+            parent[m.from] = m.from;
+            queue[tail++] = m.from;
+            while (head < tail && parent[m.to] < 0) {
+                const int h = queue[head++];
+                for (int d = 0; d < NUM_DIRECTION; d++) {
+                    const int t = hop(m.from, h, d);
+                    if (t >= 0 && parent[t] < 0) {
+                        parent[t] = h;
+                        parent_direction[t] = d;
+                        queue[tail++] = t;
+                    }
+                }
+            }
+            if (parent[m.to] < 0) {
+                return 0;
+            }
+            int length = 0;
+            for (int h = m.to; h != m.from; h = parent[h]) {
+                length++;
+            }
+            int k = length;
+            for (int h = m.to; h != m.from; h = parent[h]) {
+                directions[--k] = (direction_6::Enum)parent_direction[h];
+            }
+            return length;
+        }
+
+        void play(const move& m) {
+            const int side = to_move;
+            const int k = cell[m.from] - side * NUM_PIECE;
+            lift(side, m.from);
+            cell[m.to] = side * NUM_PIECE + k;
+            piece[side][k] = m.to;
+            place(side, m.to);
+            to_move = 1 - side;
+        }
+
+        void undo(const move& m) {
+            const int side = 1 - to_move;
+            const int k = cell[m.to] - side * NUM_PIECE;
+            lift(side, m.to);
+            cell[m.from] = side * NUM_PIECE + k;
+            piece[side][k] = m.from;
+            place(side, m.from);
+            to_move = side;
+        }
+
+        // hand the move to the other side without moving
+        void pass() {
+            to_move = 1 - to_move;
+        }
+
+        // true if all pieces of side are in its goal
+        bool finished(int side) const {
+            return in_goal_count[side] == NUM_PIECE;
+        }
+
+        // static score from the view of side to move
+        int evaluate() const {
+            return distance[1 - to_move] - distance[to_move];
+        }
+
+        // forward progress of m for side to move
+        int gain(const move& m) const {
+            const geometry& g = geo();
+            return g.goal_distance[to_move][m.from] - g.goal_distance[to_move][m.to];
+        }
+
+        int side_to_move() const {
+            return to_move;
+        }
+
+        int get_distance(int side) const {
+            return distance[side];
+        }
+
+        const uint8_t* pieces(int side) const {
+            return piece[side];
+        }
+
+        // number of pieces of side outside its goal
+        int outside(int side) const {
+            return NUM_PIECE - in_goal_count[side];
+        }
+
+        bool empty(int h) const {
+            return cell[h] < 0;
+        }
+    private:
+        void clear() {
+            memset(cell, -1, sizeof(cell));
+            count[0] = count[1] = 0;
+            distance[0] = distance[1] = 0;
+            in_goal_count[0] = in_goal_count[1] = 0;
+            to_move = 0;
+        }
+
+        void put(int side, int h) {
+            const int k = count[side]++;
+            cell[h] = side * NUM_PIECE + k;
+            piece[side][k] = h;
+            place(side, h);
+        }
+
+        void place(int side, int h) {
+            const geometry& g = geo();
+            distance[side] += g.goal_distance[side][h];
+            in_goal_count[side] += g.in_goal[side][h];
+        }
+
+        void lift(int side, int h) {
+            const geometry& g = geo();
+            distance[side] -= g.goal_distance[side][h];
+            in_goal_count[side] -= g.in_goal[side][h];
+            cell[h] = -1;
+        }
+
+        // side * NUM_PIECE + piece index, -1 if empty
+        int8_t cell[NUM_HOLE];
+        uint8_t piece[NUM_PLAYER][NUM_PIECE];
+        int count[NUM_PLAYER];
+        int distance[NUM_PLAYER];
+        int in_goal_count[NUM_PLAYER];
+        int to_move;
+};
+
+#endif
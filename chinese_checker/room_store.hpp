@@ -0,0 +1,133 @@
+#ifndef ROOM_STORE_HPP
+#define ROOM_STORE_HPP
+
+#include <cstdint>    // uint32_t, uint64_t
+#include <cstdio>     // rename
+#include <cstring>    // memcmp, memcpy
+#include <fcntl.h>    // open
+#include <string>     // string
+#include <sys/mman.h> // mmap, msync, munmap
+#include <sys/stat.h> // fstat
+#include <unistd.h>   // close, ftruncate
+#include <vector>     // vector
+
+#include "common.hpp"
+#include "game_board.hpp"
+
+constexpr char ROOM_STORE_MAGIC[8] = {'C', 'C', 'R', 'S', '0', '0', '0', '1'};
+
+// Game of a room as persisted: the snapshot a player gets at login and the
+// keys of the turn in progress, in the view of player 0.
+struct room_record {
+    std::string name;
+    snapshot_message snap;
+    std::string turn_keys;
+
+    // name length, name, snapshot, turn keys
+    void encode(std::string& out) const {
+        out += (char)name.length();
+        out += name;
+        out += snap.encode();
+        out += turn_keys;
+    }
+
+    // decode the record at p, return its length, 0 if malformed
+    size_t decode(const char* p, size_t length) {
+        if (length < 1) {
+            return 0;
+        }
+        const size_t name_length = (unsigned char)p[0];
+        size_t used = 1 + name_length + snapshot_message::LENGTH;
+        if (name_length > MAX_ROOM_NAME_LENGTH || length < used) {
+            return 0;
+        }
+        name.assign(p + 1, name_length);
+        if (!snap.decode(p + 1 + name_length, snapshot_message::LENGTH) || length < used + snap.turn_keys) {
+            return 0;
+        }
+        turn_keys.assign(p + used, snap.turn_keys);
+        return used + snap.turn_keys;
+    }
+};
+
+// Room snapshots in a memory mapped file. A file is written next to the
+// previous one and renamed over it, so a crash leaves either whole.
+class room_store {
+    public:
+        explicit room_store(const std::string& path): path(path) {}
+
+        // write records of count rooms, return false on any error
+        bool save(const std::string& records, uint32_t count) const {
+            const std::string temporary = path + ".tmp";
+            const size_t bytes = sizeof(header) + records.length();
+            int fd = ::open(temporary.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+            if (fd < 0) {
+                return false;
+            }
+            if (ftruncate(fd, bytes) != 0) {
+                ::close(fd);
+                return false;
+            }
+            void* p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            ::close(fd);
+            if (p == MAP_FAILED) {
+                return false;
+            }
+            header h;
+            memcpy(h.magic, ROOM_STORE_MAGIC, sizeof(h.magic));
+            h.rooms = count;
+            h.reserved = 0;
+            h.bytes = records.length();
+            memcpy(p, &h, sizeof(h));
+            memcpy((char*)p + sizeof(h), records.data(), records.length());
+            const bool synced = msync(p, bytes, MS_SYNC) == 0;
+            munmap(p, bytes);
+            return synced && std::rename(temporary.c_str(), path.c_str()) == 0;
+        }
+
+        // read every record, return false if the file is missing or malformed
+        bool load(std::vector<room_record>& rooms) const {
+            int fd = ::open(path.c_str(), O_RDONLY);
+            if (fd < 0) {
+                return false;
+            }
+            struct stat st;
+            if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(header)) {
+                ::close(fd);
+                return false;
+            }
+            void* p = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+            ::close(fd);
+            if (p == MAP_FAILED) {
+                return false;
+            }
+            const header* h = (const header*)p;
+            bool ok = memcmp(h->magic, ROOM_STORE_MAGIC, sizeof(h->magic)) == 0 && sizeof(header) + h->bytes == (uint64_t)st.st_size;
+            const char* next = (const char*)p + sizeof(header);
+            size_t left = ok ? h->bytes : 0;
+            for (uint32_t r = 0; ok && r < h->rooms; r++) {
+                room_record record;
+                const size_t used = record.decode(next, left);
+                if (used == 0) {
+                    ok = false;
+                    break;
+                }
+                next += used;
+                left -= used;
+                rooms.push_back(record);
+            }
+            munmap(p, st.st_size);
+            return ok && left == 0;
+        }
+    private:
+        struct header {
+            char magic[8];
+            uint32_t rooms;
+            uint32_t reserved;
+            uint64_t bytes;
+        };
+
+        const std::string path;
+};
+
+#endif
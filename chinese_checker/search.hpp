@@ -0,0 +1,306 @@
+#ifndef SEARCH_HPP
+#define SEARCH_HPP
+
+#include <algorithm>          // sort
+#include <atomic>             // atomic
+#include <chrono>             // steady_clock, milliseconds
+#include <condition_variable> // condition_variable
+#include <functional>         // function
+#include <memory>             // unique_ptr
+#include <mutex>              // mutex, unique_lock
+#include <thread>             // thread
+#include <vector>             // vector
+
+#include "position.hpp"
+#include "tablebase.hpp"
+
+constexpr int SCORE_WIN = 10000;
+// Tablebase finishes assume no side leaves the table, so they rank below
+// the finishes the search proves and above any evaluation.
+constexpr int SCORE_TABLEBASE = SCORE_WIN / 2;
+constexpr int MAX_DEPTH = 32;
+
+// true if score means a finish forced within the search
+inline bool is_win_score(int score) {
+    return score > SCORE_WIN - MAX_DEPTH || score < -SCORE_WIN + MAX_DEPTH;
+}
+
+// true if score comes from a tablebase finish
+inline bool is_tablebase_score(int score) {
+    constexpr int MAX_TABLEBASE_PLIES = MAX_DEPTH + tablebase::MAX_PLIES;
+    return !is_win_score(score) && (score > SCORE_TABLEBASE - MAX_TABLEBASE_PLIES || score < -SCORE_TABLEBASE + MAX_TABLEBASE_PLIES);
+}
+
+// negamax alpha-beta search with principal variation
+class alpha_beta {
+    public:
+        alpha_beta(): abort(nullptr), endgame(nullptr), has_deadline(false), aborted(false), nodes(0) {}
+
+        // flag polled during search, search returns false once it is set
+        void set_abort(const std::atomic<bool>* abort) {
+            this->abort = abort;
+        }
+
+        // time polled during search, search returns false once it passes
+        void set_deadline(std::chrono::steady_clock::time_point deadline) {
+            this->deadline = deadline;
+            has_deadline = true;
+        }
+
+        void clear_deadline() {
+            has_deadline = false;
+        }
+
+        // endgame tablebase probed below the root, null to disable
+        void set_tablebase(const tablebase* endgame) {
+            this->endgame = endgame;
+        }
+
+        // search pos to depth, return false if aborted
+        bool search(position& pos, int depth, int& score) {
+            aborted = false;
+            score = negamax(pos, depth, -SCORE_WIN - 1, SCORE_WIN + 1, 0);
+            if (aborted) {
+                return false;
+            }
+            best.assign(pv[0], pv[0] + pv_length[0]);
+            return true;
+        }
+
+        // principal variation of last completed search
+        const std::vector<move>& get_pv() const {
+            return best;
+        }
+
+        unsigned long long get_nodes() const {
+            return nodes;
+        }
+
+        void reset_nodes() {
+            nodes = 0;
+        }
+
+        // forget principal variation, used when switching to another position
+        void clear_pv() {
+            best.clear();
+        }
+    private:
+        struct scored_move {
+            move m;
+            int score;
+
+            bool operator<(const scored_move& o) const {
+                return score > o.score;
+            }
+        };
+
+        int negamax(position& pos, int depth, int alpha, int beta, int ply) {
+            pv_length[ply] = 0;
+            if ((++nodes & 1023) == 0) {
+                if ((abort && abort->load(std::memory_order_relaxed)) ||
+                        (has_deadline && std::chrono::steady_clock::now() > deadline)) {
+                    aborted = true;
+                }
+            }
+            if (aborted) {
+                return 0;
+            }
+            if (pos.finished(1 - pos.side_to_move())) {
+                return -SCORE_WIN + ply;
+            }
+            int plies;
+            if (ply > 0 && endgame && endgame->probe(pos, plies)) {
+                return plies > 0 ? SCORE_TABLEBASE - ply - plies : -SCORE_TABLEBASE + ply - plies;
+            }
+            if (depth == 0 || ply == MAX_DEPTH - 1) {
+                return pos.evaluate();
+            }
+            scored_move* list = moves[ply];
+            int n = order(pos, list, ply);
+            for (int k = 0; k < n; k++) {
+                const move& m = list[k].m;
+                path[ply] = m;
+                pos.play(m);
+                int score = -negamax(pos, depth - 1, -beta, -alpha, ply + 1);
+                pos.undo(m);
+                if (aborted) {
+                    return 0;
+                }
+                if (score > alpha) {
+                    alpha = score;
+                    pv[ply][0] = m;
+                    for (int i = 0; i < pv_length[ply + 1]; i++) {
+                        pv[ply][i + 1] = pv[ply + 1][i];
+                    }
+                    pv_length[ply] = pv_length[ply + 1] + 1;
+                    if (alpha >= beta) {
+                        break;
+                    }
+                }
+            }
+            return alpha;
+        }
+
+        // generate moves for ply, previous principal variation first then by progress
+        int order(position& pos, scored_move* list, int ply) {
+            move generated[MAX_MOVES];
+            int n = pos.generate(generated);
+            const bool on_pv = ply < (int)best.size() && follows_pv(ply);
+            for (int k = 0; k < n; k++) {
+                list[k].m = generated[k];
+                list[k].score = pos.gain(generated[k]);
+                if (on_pv && generated[k].from == best[ply].from && generated[k].to == best[ply].to) {
+                    list[k].score = SCORE_WIN;
+                }
+            }
+            std::sort(list, list + n);
+            return n;
+        }
+
+        // true if moves played so far are the previous principal variation
+        bool follows_pv(int ply) {
+            for (int i = 0; i < ply; i++) {
+                if (path[i].from != best[i].from || path[i].to != best[i].to) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        const std::atomic<bool>* abort;
+        const tablebase* endgame;
+        std::chrono::steady_clock::time_point deadline;
+        bool has_deadline;
+        bool aborted;
+        unsigned long long nodes;
+        move pv[MAX_DEPTH][MAX_DEPTH];
+        int pv_length[MAX_DEPTH];
+        move path[MAX_DEPTH];
+        scored_move moves[MAX_DEPTH][MAX_MOVES];
+        std::vector<move> best;
+};
+
+// engine choosing a move for the side to move
+class engine {
+    public:
+        virtual move think(const position& pos) = 0;
+        virtual ~engine() {}
+};
+
+// iterative deepening alpha-beta within a time limit
+class alpha_beta_engine: public engine {
+    public:
+        alpha_beta_engine(int milliseconds, const tablebase* endgame = nullptr):
+            milliseconds(milliseconds), searcher(new alpha_beta()) {
+            searcher->set_tablebase(endgame);
+        }
+
+        move think(const position& pos) {
+            position p = pos;
+            move moves[MAX_MOVES];
+            move best = {0, 0};
+            if (p.generate(moves) > 0) {
+                best = moves[0];
+            }
+            searcher->clear_pv();
+            searcher->set_deadline(std::chrono::steady_clock::now() + std::chrono::milliseconds(milliseconds));
+            int score;
+            for (int depth = 1; depth < MAX_DEPTH; depth++) {
+                if (!searcher->search(p, depth, score) || searcher->get_pv().empty()) {
+                    break;
+                }
+                best = searcher->get_pv()[0];
+                if (is_win_score(score)) {
+                    break;
+                }
+            }
+            searcher->clear_deadline();
+            return best;
+        }
+    private:
+        const int milliseconds;
+        std::unique_ptr<alpha_beta> searcher;
+};
+
+// background analysis, searches the latest position with iterative deepening
+class analyzer {
+    public:
+        // called from the analysis thread after every completed depth
+        typedef std::function<void(int depth, int score, const std::vector<move>& pv)> report_type;
+
+        analyzer(report_type report, const tablebase* endgame = nullptr):
+            report(report), running(true), generation(0), abort(false), searcher(new alpha_beta()), worker(&analyzer::run, this) {
+            searcher->set_tablebase(endgame);
+        }
+
+        // cancel current analysis and start analysing pos
+        void analyze(const position& pos) {
+            std::unique_lock<std::mutex> lck(mtx);
+            current = pos;
+            generation++;
+            abort.store(true, std::memory_order_relaxed);
+            cv.notify_one();
+        }
+
+        // cancel current analysis
+        void stop() {
+            std::unique_lock<std::mutex> lck(mtx);
+            idle_generation = ++generation;
+            abort.store(true, std::memory_order_relaxed);
+        }
+
+        ~analyzer() {
+            {
+                std::unique_lock<std::mutex> lck(mtx);
+                running = false;
+                abort.store(true, std::memory_order_relaxed);
+                cv.notify_one();
+            }
+            worker.join();
+        }
+    private:
+        void run() {
+            unsigned seen = 0;
+            searcher->set_abort(&abort);
+            while (true) {
+                position pos;
+                {
+                    std::unique_lock<std::mutex> lck(mtx);
+                    cv.wait(lck, [this, seen] { return !running || (generation != seen && generation != idle_generation); });
+                    if (!running) {
+                        return;
+                    }
+                    seen = generation;
+                    pos = current;
+                    abort.store(false, std::memory_order_relaxed);
+                }
+                searcher->clear_pv();
+                if (pos.finished(0) || pos.finished(1)) {
+                    continue;
+                }
+                int score;
+                for (int depth = 1; depth < MAX_DEPTH; depth++) {
+                    if (!searcher->search(pos, depth, score) || generation.load() != seen) {
+                        break;
+                    }
+                    report(depth, score, searcher->get_pv());
+                    if (is_win_score(score)) {
+                        break;
+                    }
+                }
+            }
+        }
+
+        report_type report;
+        bool running;
+        std::atomic<unsigned> generation;
+        unsigned idle_generation = 0;
+        std::atomic<bool> abort;
+        position current;
+        std::unique_ptr<alpha_beta> searcher;
+        std::mutex mtx;
+        std::condition_variable cv;
+        std::thread worker;
+};
+
+#endif
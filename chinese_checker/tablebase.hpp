@@ -0,0 +1,250 @@
+#ifndef TABLEBASE_HPP
+#define TABLEBASE_HPP
+
+#include <cstdint>    // uint8_t, uint64_t
+#include <cstdio>     // FILE, fopen, fwrite
+#include <cstring>    // memcmp, memcpy
+#include <fcntl.h>    // open
+#include <sys/mman.h> // mmap, munmap
+#include <sys/stat.h> // fstat
+#include <unistd.h>   // close
+#include <utility>    // swap
+
+#include "position.hpp"
+
+constexpr int NUM_OUTSIDE = NUM_HOLE - NUM_PIECE;
+constexpr int MAX_TABLEBASE_OUTSIDE = 1;
+constexpr char TABLEBASE_PATH[] = "chinese_checker.tb";
+constexpr char TABLEBASE_MAGIC[8] = {'C', 'C', 'T', 'B', '0', '0', '0', '1'};
+
+// Endgame tablebase of all positions where each side has at most K pieces
+// outside its goal. A side is indexed by which of its goal holes are vacated
+// and which outside holes it occupies, both ranked in the combinatorial
+// number system, so (side 0, side 1, side to move) maps to a dense index.
+// Each entry is one byte: UNKNOWN, n (1..MAX_PLIES) when the side to move
+// finishes after n plies, or LOSS | n when the opponent finishes after n plies.
+// Moves taking a side beyond K pieces outside are not considered, so a side
+// that could delay by leaving the table is scored as if it could not.
+// K is at most MAX_TABLEBASE_OUTSIDE: the index is dense over both sides, so
+// K=1 takes about 2.5M entries and K=2 would take about 1.5e11.
+class tablebase {
+    public:
+        static constexpr uint8_t UNKNOWN = 0;
+        static constexpr uint8_t LOSS = 0x80;
+        static constexpr uint8_t MAX_PLIES = 0x7f;
+
+        tablebase(int max_outside = 0): data(nullptr), length(0) {
+            for (int n = 0; n <= NUM_OUTSIDE; n++) {
+                binomial[n][0] = 1;
+                for (int k = 1; k <= MAX_TABLEBASE_OUTSIDE; k++) {
+                    binomial[n][k] = n == 0 ? 0 : binomial[n - 1][k - 1] + binomial[n - 1][k];
+                }
+            }
+            set_max_outside(max_outside);
+        }
+
+        ~tablebase() {
+            close_file();
+        }
+
+        // map a tablebase file, return false if missing or malformed
+        bool open(const char* path) {
+            close_file();
+            int fd = ::open(path, O_RDONLY);
+            if (fd < 0) {
+                return false;
+            }
+            struct stat st;
+            if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(header)) {
+                ::close(fd);
+                return false;
+            }
+            void* p = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+            ::close(fd);
+            if (p == MAP_FAILED) {
+                return false;
+            }
+            const header* h = (const header*)p;
+            if (memcmp(h->magic, TABLEBASE_MAGIC, sizeof(h->magic)) != 0 || h->max_outside > MAX_TABLEBASE_OUTSIDE) {
+                munmap(p, st.st_size);
+                return false;
+            }
+            set_max_outside(h->max_outside);
+            if ((uint64_t)st.st_size != sizeof(header) + size()) {
+                munmap(p, st.st_size);
+                return false;
+            }
+            length = st.st_size;
+            data = (const uint8_t*)p;
+            values = data + sizeof(header);
+            return true;
+        }
+
+        // write values of size() entries to path
+        bool save(const char* path, const uint8_t* entries) const {
+            FILE* f = fopen(path, "wb");
+            if (!f) {
+                return false;
+            }
+            header h;
+            memcpy(h.magic, TABLEBASE_MAGIC, sizeof(h.magic));
+            h.max_outside = max_outside;
+            h.entries = size();
+            bool ok = fwrite(&h, sizeof(h), 1, f) == 1 && fwrite(entries, 1, size(), f) == size();
+            return fclose(f) == 0 && ok;
+        }
+
+        bool loaded() const {
+            return data != nullptr;
+        }
+
+        int get_max_outside() const {
+            return max_outside;
+        }
+
+        // number of configurations of one side
+        uint64_t side_size() const {
+            return offset[max_outside + 1];
+        }
+
+        // number of entries
+        uint64_t size() const {
+            return side_size() * side_size() * NUM_PLAYER;
+        }
+
+        // true if pos is indexed
+        bool contains(const position& pos) const {
+            return pos.outside(0) <= max_outside && pos.outside(1) <= max_outside;
+        }
+
+        uint64_t index(const position& pos) const {
+            return (side_index(pos, 0) * side_size() + side_index(pos, 1)) * NUM_PLAYER + pos.side_to_move();
+        }
+
+        // holes of side in its configuration i
+        void side_holes(int side, uint64_t i, uint8_t* holes) const {
+            int k = 0;
+            while (offset[k + 1] <= i) {
+                k++;
+            }
+            i -= offset[k];
+            const uint64_t outside_rank = i % binomial[NUM_OUTSIDE][k];
+            uint64_t vacated_rank = i / binomial[NUM_OUTSIDE][k];
+            int vacated[MAX_TABLEBASE_OUTSIDE];
+            int occupied[MAX_TABLEBASE_OUTSIDE];
+            unrank(vacated_rank, k, vacated);
+            unrank(outside_rank, k, occupied);
+            int count = 0;
+            for (int g = 0, v = 0; g < NUM_PIECE; g++) {
+                if (v < k && vacated[v] == g) {
+                    v++;
+                } else {
+                    holes[count++] = goal_hole(side, g);
+                }
+            }
+            for (int o = 0; o < k; o++) {
+                holes[count++] = outside_hole(side, occupied[o]);
+            }
+        }
+
+        // plies to finish from the view of side to move: > 0 finishes, <= 0 loses.
+        // Return false if pos is not in the table or unresolved.
+        bool probe(const position& pos, int& plies) const {
+            if (!data || !contains(pos)) {
+                return false;
+            }
+            const uint8_t v = values[index(pos)];
+            if (v == UNKNOWN) {
+                return false;
+            }
+            plies = (v & LOSS) ? -(int)(v & MAX_PLIES) : (int)v;
+            return true;
+        }
+    private:
+        struct header {
+            char magic[8];
+            uint32_t max_outside;
+            uint32_t reserved;
+            uint64_t entries;
+        };
+
+        void set_max_outside(int k) {
+            max_outside = k;
+            offset[0] = 0;
+            for (int j = 0; j <= k; j++) {
+                offset[j + 1] = offset[j] + binomial[NUM_PIECE][j] * binomial[NUM_OUTSIDE][j];
+            }
+        }
+
+        void close_file() {
+            if (data) {
+                munmap((void*)data, length);
+                data = nullptr;
+            }
+        }
+
+        // goal and outside holes of side by local index
+        static int goal_hole(int side, int g) {
+            return side == 0 ? g : NUM_OUTSIDE + g;
+        }
+
+        static int outside_hole(int side, int o) {
+            return side == 0 ? NUM_PIECE + o : o;
+        }
+
+        uint64_t side_index(const position& pos, int side) const {
+            const position::geometry& geo = position::geo();
+            bool filled[NUM_PIECE] = {false};
+            int occupied[MAX_TABLEBASE_OUTSIDE];
+            int vacated[MAX_TABLEBASE_OUTSIDE];
+            int k = 0;
+            for (int p = 0; p < NUM_PIECE; p++) {
+                const int h = pos.pieces(side)[p];
+                if (geo.in_goal[side][h]) {
+                    filled[side == 0 ? h : h - NUM_OUTSIDE] = true;
+                } else {
+                    occupied[k++] = side == 0 ? h - NUM_PIECE : h;
+                }
+            }
+            for (int g = 0, v = 0; g < NUM_PIECE; g++) {
+                if (!filled[g]) {
+                    vacated[v++] = g;
+                }
+            }
+            return offset[k] + rank(vacated, k) * binomial[NUM_OUTSIDE][k] + rank(occupied, k);
+        }
+
+        // rank of k distinct values, sorted in place
+        uint64_t rank(int* values, int k) const {
+            for (int i = 1; i < k; i++) {
+                for (int j = i; j > 0 && values[j - 1] > values[j]; j--) {
+                    std::swap(values[j - 1], values[j]);
+                }
+            }
+            uint64_t r = 0;
+            for (int i = 0; i < k; i++) {
+                r += binomial[values[i]][i + 1];
+            }
+            return r;
+        }
+
+        void unrank(uint64_t r, int k, int* values) const {
+            for (int i = k - 1; i >= 0; i--) {
+                int c = i;
+                while (binomial[c + 1][i + 1] <= r) {
+                    c++;
+                }
+                values[i] = c;
+                r -= binomial[c][i + 1];
+            }
+        }
+
+        uint64_t binomial[NUM_OUTSIDE + 1][MAX_TABLEBASE_OUTSIDE + 1];
+        uint64_t offset[MAX_TABLEBASE_OUTSIDE + 2];
+        int max_outside;
+        const uint8_t* data;
+        const uint8_t* values;
+        size_t length;
+};
+
+#endif
@@ -0,0 +1,47 @@
+#ifndef TRANSPORT_HPP
+#define TRANSPORT_HPP
+
+#include <string> // string
+#include <vector> // vector
+
+#include <boost/asio.hpp>
+
+// Clients reach the server over TCP or, on the same host, over a Unix domain
+// stream socket, which skips the loopback TCP stack. Both carry the same
+// frames through the same generic stream socket type.
+typedef boost::asio::generic::stream_protocol::endpoint stream_endpoint;
+typedef boost::asio::generic::stream_protocol::socket stream_socket;
+typedef boost::asio::basic_socket_acceptor<boost::asio::generic::stream_protocol> stream_acceptor;
+
+constexpr char LOCAL_PREFIX[] = "unix:";
+
+// true for a host naming a Unix domain socket, "unix:path"
+inline bool is_local_host(const std::string& host) {
+    return host.compare(0, sizeof(LOCAL_PREFIX) - 1, LOCAL_PREFIX) == 0;
+}
+
+// endpoints of a server, the port is not used for a Unix domain socket
+inline std::vector<stream_endpoint> resolve_stream(boost::asio::io_context& io_context, const std::string& host,
+        const std::string& port) {
+    std::vector<stream_endpoint> endpoints;
+    if (is_local_host(host)) {
+        endpoints.push_back(boost::asio::local::stream_protocol::endpoint(host.substr(sizeof(LOCAL_PREFIX) - 1)));
+        return endpoints;
+    }
+    boost::asio::ip::tcp::resolver resolver(io_context);
+    for (const boost::asio::ip::tcp::resolver::results_type::value_type& entry: resolver.resolve(host, port)) {
+        endpoints.push_back(entry.endpoint());
+    }
+    return endpoints;
+}
+
+// send small frames at once over TCP, nothing to do over a Unix domain socket
+template <typename Socket>
+void set_no_delay(Socket& socket) {
+    boost::system::error_code ec;
+    if (socket.local_endpoint(ec).protocol().family() != AF_UNIX) {
+        socket.set_option(boost::asio::ip::tcp::no_delay(true), ec);
+    }
+}
+
+#endif
@@ -0,0 +1,431 @@
+#ifndef ASYNC_LOGGER_HPP
+#define ASYNC_LOGGER_HPP
+
+#include <algorithm>          // find, min, stable_sort
+#include <atomic>             // atomic
+#include <cerrno>             // errno, EINTR
+#include <chrono>             // steady_clock, system_clock, milliseconds
+#include <condition_variable> // condition_variable
+#include <cstdint>            // int64_t, uint64_t
+#include <cstdio>             // snprintf
+#include <cstring>            // memcpy, strlen
+#include <ctime>              // time_t, localtime_r, strftime
+#include <fcntl.h>            // open
+#include <iostream>           // cerr
+#include <memory>             // shared_ptr, unique_ptr
+#include <mutex>              // mutex, unique_lock
+#include <string>             // string
+#include <thread>             // thread
+#include <type_traits>        // enable_if, is_integral, is_signed
+#include <unistd.h>           // write, close
+#include <vector>             // vector
+
+#include "lockable.hpp"
+
+namespace log_levels {
+    enum {
+        DEBUG = 0,
+        INFO,
+        WARN,
+        ERROR
+    };
+}
+
+// A log call as recorded by the thread making it: the time, the format and
+// its arguments encoded, text is made by the flushing thread.
+struct log_record {
+    static constexpr size_t DATA_LENGTH = 104;
+
+    // nanoseconds on the steady clock
+    int64_t time;
+    // a literal, it outlives the record
+    const char* format;
+    uint8_t level;
+    // number of the thread, in the order threads first logged
+    uint16_t thread;
+    // bytes of data used
+    uint8_t length;
+    char data[DATA_LENGTH];
+
+    // arguments as a kind byte then the value, one that does not fit is left out
+    void put(char kind, const void* value, size_t n) {
+        if (length + 1 + n > DATA_LENGTH) {
+            return;
+        }
+        data[length] = kind;
+        memcpy(data + length + 1, value, n);
+        length += 1 + n;
+    }
+
+    // text is cut to the room left
+    void put_text(const char* text, size_t n) {
+        if ((size_t)length + 2 > DATA_LENGTH) {
+            return;
+        }
+        n = std::min(n, DATA_LENGTH - length - 2);
+        data[length] = 's';
+        data[length + 1] = (char)n;
+        memcpy(data + length + 2, text, n);
+        length += 2 + n;
+    }
+
+    void put_value(const std::string& text) {
+        put_text(text.data(), text.length());
+    }
+
+    void put_value(const char* text) {
+        put_text(text, strlen(text));
+    }
+
+    void put_value(char c) {
+        put('c', &c, 1);
+    }
+
+    void put_value(double d) {
+        put('d', &d, sizeof(d));
+    }
+
+    template <typename T>
+    typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value>::type put_value(T value) {
+        const int64_t v = value;
+        put('i', &v, sizeof(v));
+    }
+
+    template <typename T>
+    typename std::enable_if<std::is_integral<T>::value && !std::is_signed<T>::value>::type put_value(T value) {
+        const uint64_t v = value;
+        put('u', &v, sizeof(v));
+    }
+
+    void encode() {}
+
+    template <typename T, typename... Args>
+    void encode(const T& value, const Args&... args) {
+        put_value(value);
+        encode(args...);
+    }
+
+    // the format with every {} replaced by the next argument
+    void format_to(std::string& out) const {
+        size_t at = 0;
+        for (const char* f = format; *f; f++) {
+            if (f[0] == '{' && f[1] == '}' && at < length) {
+                at = append_argument(out, at);
+                f++;
+            } else {
+                out += *f;
+            }
+        }
+    }
+private:
+    size_t append_argument(std::string& out, size_t at) const {
+        const char kind = data[at++];
+        char number[32];
+        if (kind == 's') {
+            const size_t n = (unsigned char)data[at];
+            out.append(data + at + 1, n);
+            return at + 1 + n;
+        } else if (kind == 'c') {
+            out += data[at];
+            return at + 1;
+        } else if (kind == 'd') {
+            double d;
+            memcpy(&d, data + at, sizeof(d));
+            snprintf(number, sizeof(number), "%g", d);
+        } else if (kind == 'i') {
+            int64_t v;
+            memcpy(&v, data + at, sizeof(v));
+            snprintf(number, sizeof(number), "%lld", (long long)v);
+        } else {
+            uint64_t v;
+            memcpy(&v, data + at, sizeof(v));
+            snprintf(number, sizeof(number), "%llu", (unsigned long long)v);
+        }
+        out += number;
+        return at + 8;
+    }
+};
+
+constexpr size_t log_record::DATA_LENGTH;
+
+// Records of one thread on their way to the flushing thread. One producer
+// and one consumer, each owning its index, so neither locks nor waits: a
+// record finding the ring full is dropped and counted.
+class log_ring {
+    public:
+        static constexpr size_t CAPACITY = 4096;
+
+        explicit log_ring(int thread): thread(thread), records(new log_record[CAPACITY]), head(0), cached_head(0),
+            tail(0), dropped(0) {}
+
+        // slot for the next record, nullptr if full, producer only
+        log_record* claim() {
+            const size_t t = tail.load(std::memory_order_relaxed);
+            if (t - cached_head == CAPACITY) {
+                cached_head = head.load(std::memory_order_acquire);
+                if (t - cached_head == CAPACITY) {
+                    dropped.fetch_add(1, std::memory_order_relaxed);
+                    return nullptr;
+                }
+            }
+            return &records[t & (CAPACITY - 1)];
+        }
+
+        // make the claimed record visible, producer only
+        void publish() {
+            tail.store(tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        }
+
+        // move every published record to out, consumer only
+        void drain(std::vector<log_record>& out) {
+            size_t h = head.load(std::memory_order_relaxed);
+            const size_t t = tail.load(std::memory_order_acquire);
+            for (; h != t; h++) {
+                out.push_back(records[h & (CAPACITY - 1)]);
+            }
+            head.store(h, std::memory_order_release);
+        }
+
+        uint64_t take_dropped() {
+            return dropped.exchange(0, std::memory_order_relaxed);
+        }
+
+        const int thread;
+    private:
+        std::unique_ptr<log_record[]> records;
+        // the indices are written by different threads, keep them on their own cache lines
+        char pad0[64];
+        std::atomic<size_t> head;
+        // head as last seen by the producer
+        size_t cached_head;
+        char pad1[64];
+        std::atomic<size_t> tail;
+        std::atomic<uint64_t> dropped;
+};
+
+constexpr size_t log_ring::CAPACITY;
+
+// Logs from any thread without locking or system calls on the calling
+// thread. Each thread writes records into a ring of its own, a thread of the
+// logger formats them in time order and writes them to the file every few
+// milliseconds. Formats must be literals, {} is replaced by the next
+// argument (integers, floating point, chars and strings, cut to fit a
+// record). The logger must outlive the threads logging into it.
+class async_logger: public lockable {
+    public:
+        // path "-" writes to standard error
+        async_logger(const std::string& path, int min_level): id(next_id().fetch_add(1) + 1), min_level(min_level),
+            steady_start(std::chrono::steady_clock::now()), system_start(std::chrono::system_clock::now()),
+            next_thread(0), stopping(false) {
+            fd = path == "-" ? STDERR_FILENO : ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+            if (fd < 0) {
+                std::cerr << "Failed to open the log file " << path << "\n";
+            }
+            writer = std::thread([this]() {
+                    run();
+                    });
+        }
+
+        ~async_logger() {
+            {
+                std::lock_guard<std::mutex> lck(mtx);
+                stopping = true;
+            }
+            cv.notify_one();
+            writer.join();
+            if (fd > STDERR_FILENO) {
+                ::close(fd);
+            }
+        }
+
+        bool enabled(int level) const {
+            return level >= min_level;
+        }
+
+        template <typename... Args>
+        void log(int level, const char* format, const Args&... args) {
+            if (!enabled(level)) {
+                return;
+            }
+            log_ring& ring = local_ring();
+            log_record* r = ring.claim();
+            if (!r) {
+                return;
+            }
+            r->time = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now().time_since_epoch()).count();
+            r->format = format;
+            r->level = level;
+            r->thread = ring.thread;
+            r->length = 0;
+            r->encode(args...);
+            ring.publish();
+        }
+
+        template <typename... Args>
+        void debug(const char* format, const Args&... args) {
+            log(log_levels::DEBUG, format, args...);
+        }
+
+        template <typename... Args>
+        void info(const char* format, const Args&... args) {
+            log(log_levels::INFO, format, args...);
+        }
+
+        template <typename... Args>
+        void warn(const char* format, const Args&... args) {
+            log(log_levels::WARN, format, args...);
+        }
+
+        template <typename... Args>
+        void error(const char* format, const Args&... args) {
+            log(log_levels::ERROR, format, args...);
+        }
+    private:
+        static constexpr int FLUSH_MILLISECONDS = 10;
+
+        // the ring of this thread, made on its first record
+        struct thread_ring {
+            uint64_t owner = 0;
+            std::shared_ptr<log_ring> ring;
+        };
+
+        // loggers are told apart by id, an address may be reused
+        static std::atomic<uint64_t>& next_id() {
+            static std::atomic<uint64_t> id(0);
+            return id;
+        }
+
+        log_ring& local_ring() {
+            thread_local thread_ring local;
+            if (local.owner != id) {
+                local.ring = std::make_shared<log_ring>(next_thread.fetch_add(1, std::memory_order_relaxed));
+                local.owner = id;
+                ATOMIC_RUN(
+                        rings.push_back(local.ring);
+                        )
+            }
+            return *local.ring;
+        }
+
+        void run() {
+            std::unique_lock<std::mutex> lck(mtx);
+            while (!stopping) {
+                cv.wait_for(lck, std::chrono::milliseconds(FLUSH_MILLISECONDS));
+                lck.unlock();
+                flush();
+                lck.lock();
+            }
+            lck.unlock();
+            flush();
+        }
+
+        void flush() {
+            lock();
+            std::vector<std::shared_ptr<log_ring> > current(rings);
+            unlock();
+            batch.clear();
+            text.clear();
+            std::vector<log_ring*> ended;
+            for (const std::shared_ptr<log_ring>& ring: current) {
+                // held by the list and its copy alone once its thread is gone, nothing follows what is drained
+                if (ring.use_count() == 2) {
+                    ended.push_back(ring.get());
+                }
+                ring->drain(batch);
+                const uint64_t dropped = ring->take_dropped();
+                if (dropped) {
+                    text += "log: dropped " + std::to_string(dropped) + " records of thread "
+                        + std::to_string(ring->thread) + "\n";
+                }
+            }
+            if (!ended.empty()) {
+                forget(ended);
+            }
+            // threads are merged by time, each ring is in order already
+            std::stable_sort(batch.begin(), batch.end(), [](const log_record& a, const log_record& b) {
+                    return a.time < b.time;
+                    });
+            for (const log_record& r: batch) {
+                format(r);
+            }
+            if (fd >= 0 && !text.empty()) {
+                write_all(text);
+            }
+        }
+
+        // drop the rings of threads that ended, once their last records are drained
+        void forget(const std::vector<log_ring*>& ended) {
+            lock();
+            std::vector<std::shared_ptr<log_ring> > kept;
+            for (const std::shared_ptr<log_ring>& ring: rings) {
+                if (std::find(ended.begin(), ended.end(), ring.get()) == ended.end()) {
+                    kept.push_back(ring);
+                }
+            }
+            rings.swap(kept);
+            unlock();
+        }
+
+        // "2026-01-01 12:00:00.000000 INFO t0 " then the message
+        void format(const log_record& r) {
+            static const char* const names[] = {"DEBUG", "INFO ", "WARN ", "ERROR"};
+            const int64_t since = r.time - std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    steady_start.time_since_epoch()).count();
+            const std::chrono::system_clock::time_point wall = system_start + std::chrono::duration_cast<
+                std::chrono::system_clock::duration>(std::chrono::nanoseconds(since));
+            const int64_t micros = std::chrono::duration_cast<std::chrono::microseconds>(wall.time_since_epoch()).count();
+            const time_t seconds = micros / 1000000;
+            // the date changes once a second
+            if (seconds != formatted_second) {
+                struct tm local;
+                localtime_r(&seconds, &local);
+                strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%S", &local);
+                formatted_second = seconds;
+            }
+            char prefix[64];
+            snprintf(prefix, sizeof(prefix), "%s.%06d %s t%d ", date, (int)(micros % 1000000),
+                    names[std::min<int>(r.level, log_levels::ERROR)], (int)r.thread);
+            text += prefix;
+            r.format_to(text);
+            text += '\n';
+        }
+
+        bool write_all(const std::string& out) {
+            const char* p = out.data();
+            size_t left = out.length();
+            while (left > 0) {
+                const ssize_t n = ::write(fd, p, left);
+                if (n < 0) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    return false;
+                }
+                p += n;
+                left -= n;
+            }
+            return true;
+        }
+
+        const uint64_t id;
+        const int min_level;
+        const std::chrono::steady_clock::time_point steady_start;
+        const std::chrono::system_clock::time_point system_start;
+        int fd;
+        std::atomic<int> next_thread;
+        std::vector<std::shared_ptr<log_ring> > rings;
+        // used by the flushing thread alone
+        std::vector<log_record> batch;
+        std::string text;
+        time_t formatted_second = -1;
+        char date[32];
+        std::mutex mtx;
+        std::condition_variable cv;
+        bool stopping;
+        std::thread writer;
+};
+
+constexpr int async_logger::FLUSH_MILLISECONDS;
+
+#endif
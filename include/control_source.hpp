@@ -1,18 +1,18 @@
 #ifndef CONTROL_SOURCE_HPP
 #define CONTROL_SOURCE_HPP
 
-#include <condition_variable> // condition_variable
+#include <cstddef>            // size_t
 #include <exception>          // exception
-#include <mutex>              // mutex, unique_lock
-#include <queue>              // queue
+#include <string>             // string
 #include <termios.h>          // termios, tcsetattr, tcgetattr
-#include <thread>             // this_thread
+#include <thread>             // thread
 
 #include <boost/asio.hpp>
 #include <boost/thread.hpp>
 
 #include "board.hpp"
 #include "lockable.hpp"
+#include "ring_buffer.hpp"
 
 using boost::asio::ip::tcp;
 
@@ -27,81 +27,123 @@ class connection_error: public std::exception {
         }
 };
 
-template<bool Is_Lock_Free = true>
-class blocking_queue: public lockable {
+// Keys from a control source to the game, with CHAR_EXCEPTION put last when
+// the source is lost, which get and drain throw as connection_error. A lock
+// free ring of Capacity keys, for one producer or several with
+// Multiple_Producers, and one consumer. Puts wait while the ring is full and
+// gets while it is empty, spinning a little on several cores then sleeping
+// on a futex; each side wakes the other only when it sleeps, producers once
+// the ring is half empty. Lock free queues let the
+// consumer poll with has_next, the others hand over one key at a time: a put
+// returns once the consumer took every earlier key.
+template<bool Is_Lock_Free = true, bool Multiple_Producers = false, size_t Capacity = 256>
+class blocking_queue {
     public:
-        blocking_queue() {}
-
-        template<bool enabled = Is_Lock_Free>
-        void put(typename std::enable_if<enabled, char>::type c) {
-            ATOMIC_RUN(
-                    q.push(c);
-                    )
-        }
-
-        template<bool enabled = Is_Lock_Free>
-        void put(typename std::enable_if<!enabled, char>::type c) {
-            std::unique_lock<std::mutex> lck(mtx);
-            while (!q.empty()) {
-                lck.unlock();
-                std::this_thread::yield();
-                lck.lock();
-            }
-            q.push(c);
-            cv.notify_one();
+        blocking_queue(): failed(false) {}
+
+        void put(char c) {
+            put_n(&c, 1);
         }
 
-        template<bool enabled = Is_Lock_Free>
-        typename std::enable_if<enabled, char>::type get() {
-            ATOMIC_RUN(
-                    char c = q.front();
-                    q.pop();
-                    )
-            if (c == CHAR_EXCEPTION) {
-                throw connection_error();
+        // put n keys in order, in as few steps as the ring allows
+        void put_n(const char* keys, size_t n) {
+            while (n > 0) {
+                const size_t k = ring.try_put_n(keys, n);
+                if (k == 0) {
+                    wait_for(space, [this]() {
+                            return ring.has_space();
+                            });
+                    continue;
+                }
+                keys += k;
+                n -= k;
+                filled.notify();
+            }
+            if (!Is_Lock_Free) {
+                wait_for(space, [this]() {
+                        return ring.empty();
+                        });
             }
-            return c;
         }
 
-        template<bool enabled = Is_Lock_Free>
-        typename std::enable_if<!enabled, char>::type get() {
-            std::unique_lock<std::mutex> lck(mtx);
-            if (q.empty()) {
-                cv.wait(lck);
-            }
-            char c = q.front();
-            q.pop();
-            if (c == CHAR_EXCEPTION) {
-                throw connection_error();
+        char get() {
+            char c;
+            while (drain(&c, 1) == 0) {
+                wait_for(filled, [this]() {
+                        return !ring.empty();
+                        });
             }
             return c;
         }
 
-        template<bool enabled = Is_Lock_Free>
-        typename std::enable_if<enabled, bool>::type has_next() {
-            return !q.empty();
+        // take up to max keys without waiting, return how many. Keys before
+        // CHAR_EXCEPTION are returned first, the next call throws.
+        size_t drain(char* keys, size_t max) {
+            if (failed) {
+                throw connection_error();
+            }
+            size_t n = ring.drain(keys, max);
+            // producers wait for half the ring, not for each slot, so they wake once per many keys
+            if (n && ring.size() <= Capacity / 2) {
+                space.notify();
+            }
+            for (size_t i = 0; i < n; i++) {
+                if (keys[i] == CHAR_EXCEPTION) {
+                    failed = true;
+                    if (i == 0) {
+                        throw connection_error();
+                    }
+                    return i;
+                }
+            }
+            return n;
         }
 
-        template<bool enabled = Is_Lock_Free>
-        typename std::enable_if<enabled>::type clear() {
-            ATOMIC_RUN(
-                    std::queue<char> empty;
-                    empty.swap(q);
-                    )
+        bool has_next() const {
+            return failed || !ring.empty();
         }
 
-        template<bool enabled = Is_Lock_Free>
-        typename std::enable_if<!enabled>::type clear() {
-            std::queue<char> empty;
-            std::unique_lock<std::mutex> lck(mtx);
-            empty.swap(q);
+        // drop the keys put so far, consumer only
+        void clear() {
+            char keys[Capacity];
+            while (ring.drain(keys, Capacity)) {
+            }
+            space.notify();
         }
     private:
-        std::queue<char> q;
-        std::condition_variable cv;
-        std::mutex mtx;
+        // spin for the condition a while, then sleep until the other side notifies
+        template <typename Condition>
+        void wait_for(event_count& event, Condition condition) {
+            // the other side cannot run on this core meanwhile
+            static const int spins = std::thread::hardware_concurrency() > 1 ? SPINS : 0;
+            for (int i = 0; i < spins; i++) {
+                if (condition()) {
+                    return;
+                }
+                cpu_relax();
+            }
+            while (!condition()) {
+                const int key = event.prepare_wait();
+                if (condition()) {
+                    return;
+                }
+                event.wait(key);
+            }
+        }
+
+        static constexpr int SPINS = 1000;
+
+        ring_buffer<char, Capacity, Multiple_Producers> ring;
+        // a producer waits on space, the consumer on filled
+        event_count space;
+        event_count filled;
+        // CHAR_EXCEPTION was taken, consumer only
+        bool failed;
 };
 
+template<bool Is_Lock_Free, bool Multiple_Producers, size_t Capacity>
+constexpr int blocking_queue<Is_Lock_Free, Multiple_Producers, Capacity>::SPINS;
+
 template <typename Board_T>
 class control_source {
     public:
@@ -133,9 +175,17 @@ class unix_keyboard_control_source: public virtual control_source<Board_T> {
 template <typename Board_T>
 class remote_control_source: public virtual control_source<Board_T> {
     public:
+        // host "unix:path" connects to a Unix domain socket on this host, port is not used
         remote_control_source(const char* host, const char* port): io_context(), s(io_context) {
+            const std::string name(host);
+            if (name.compare(0, 5, "unix:") == 0) {
+                s.connect(boost::asio::generic::stream_protocol::endpoint(boost::asio::local::stream_protocol::endpoint(name.substr(5))));
+                return;
+            }
             tcp::resolver resolver(io_context);
-            boost::asio::connect(s, resolver.resolve(host, port));
+            tcp::socket t(io_context);
+            boost::asio::connect(t, resolver.resolve(host, port));
+            s = std::move(t);
         }
 
         ~remote_control_source() {
@@ -149,7 +199,7 @@ class remote_control_source: public virtual control_source<Board_T> {
         virtual void logout() = 0;
     protected:
         boost::asio::io_context io_context;
-        tcp::socket s;
+        boost::asio::generic::stream_protocol::socket s;
 };
 
 template <typename Board_T, bool Is_Lock_Free, char Char_On_Exit = ' '>
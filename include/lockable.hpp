@@ -3,21 +3,89 @@
 
 #define ATOMIC_RUN(op) lock(); op unlock();
 
-#include <atomic>    // atomic_flag
+#include <atomic>    // atomic
+#include <thread>    // yield
 
+#ifdef __linux__
+#include <linux/futex.h> // FUTEX_WAIT_PRIVATE, FUTEX_WAKE_PRIVATE
+#include <sys/syscall.h> // SYS_futex
+#include <unistd.h>      // syscall
+#endif
+
+// let the other hyperthread run while spinning
+inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+    asm volatile("yield" ::: "memory");
+#endif
+}
+
+// Lock for short critical sections. An uncontended lock or unlock is one
+// atomic instruction. A contended lock spins with exponential backoff for
+// about as long as a critical section lasts, then sleeps on a futex until
+// woken by unlock, so a holder that was descheduled does not cost waiters
+// their whole time slice. Without futexes waiters yield instead of sleeping.
 class lockable {
     public:
-        lockable(): _lock(ATOMIC_FLAG_INIT) {}
+        lockable(): _state(UNLOCKED) {}
 
         void lock() {
-            while (_lock.test_and_set(std::memory_order_acquire));
+            int expected = UNLOCKED;
+            if (_state.compare_exchange_strong(expected, LOCKED, std::memory_order_acquire)) {
+                return;
+            }
+            // spin reading, not writing, so the line stays shared until it is free
+            for (int pauses = 1; pauses <= MAX_PAUSES; pauses *= 2) {
+                for (int i = 0; i < pauses; i++) {
+                    cpu_relax();
+                }
+                expected = UNLOCKED;
+                if (_state.load(std::memory_order_relaxed) == UNLOCKED &&
+                        _state.compare_exchange_strong(expected, LOCKED, std::memory_order_acquire)) {
+                    return;
+                }
+            }
+            // marked contended, so unlock wakes a sleeper
+            while (_state.exchange(CONTENDED, std::memory_order_acquire) != UNLOCKED) {
+                wait();
+            }
         }
 
         void unlock() {
-            _lock.clear(std::memory_order_release);
+            if (_state.exchange(UNLOCKED, std::memory_order_release) == CONTENDED) {
+                wake();
+            }
         }
     private:
-        std::atomic_flag _lock;
+        enum {
+            UNLOCKED = 0,
+            LOCKED,
+            // locked and a thread may sleep on it
+            CONTENDED
+        };
+
+        // pauses of the last backoff step, about 2000 in all
+        static constexpr int MAX_PAUSES = 1024;
+
+        // sleep while still contended
+        void wait() {
+#ifdef __linux__
+            syscall(SYS_futex, reinterpret_cast<int*>(&_state), FUTEX_WAIT_PRIVATE, CONTENDED, nullptr, nullptr, 0);
+#else
+            std::this_thread::yield();
+#endif
+        }
+
+        void wake() {
+#ifdef __linux__
+            syscall(SYS_futex, reinterpret_cast<int*>(&_state), FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+#endif
+        }
+
+        std::atomic<int> _state;
 };
 
+constexpr int lockable::MAX_PAUSES;
+
 #endif
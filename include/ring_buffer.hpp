@@ -0,0 +1,181 @@
+#ifndef RING_BUFFER_HPP
+#define RING_BUFFER_HPP
+
+#include <algorithm> // min
+#include <atomic>    // atomic, atomic_thread_fence
+#include <climits>   // INT_MAX
+#include <cstddef>   // size_t
+#include <thread>    // yield
+
+#ifdef __linux__
+#include <linux/futex.h> // FUTEX_WAIT_PRIVATE, FUTEX_WAKE_PRIVATE
+#include <sys/syscall.h> // SYS_futex
+#include <unistd.h>      // syscall
+#endif
+
+// Lets threads sleep until a condition they check without a lock may have
+// changed. A waiter calls prepare_wait, checks its condition, then wait with
+// the key prepare_wait returned; whoever changes the condition calls notify.
+// Notify costs a fence and a load unless a waiter may sleep, then it wakes
+// them all once, so a run of notifies makes one system call. Without
+// futexes waiters yield.
+class event_count {
+    public:
+        event_count(): epoch(0), sleeping(false) {}
+
+        int prepare_wait() {
+            sleeping.store(true, std::memory_order_seq_cst);
+            const int key = epoch.load(std::memory_order_seq_cst);
+            // the condition is checked after this, notify sees the waiter or the waiter sees the change
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            return key;
+        }
+
+        // sleep unless notified since prepare_wait
+        void wait(int key) {
+#ifdef __linux__
+            syscall(SYS_futex, reinterpret_cast<int*>(&epoch), FUTEX_WAIT_PRIVATE, key, nullptr, nullptr, 0);
+#else
+            (void)key;
+            std::this_thread::yield();
+#endif
+        }
+
+        void notify() {
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (!sleeping.load(std::memory_order_relaxed) || !sleeping.exchange(false, std::memory_order_seq_cst)) {
+                return;
+            }
+            epoch.fetch_add(1, std::memory_order_seq_cst);
+#ifdef __linux__
+            syscall(SYS_futex, reinterpret_cast<int*>(&epoch), FUTEX_WAKE_PRIVATE, INT_MAX, nullptr, nullptr, 0);
+#endif
+        }
+    private:
+        std::atomic<int> epoch;
+        // a waiter may sleep, cleared by the notify waking it
+        std::atomic<bool> sleeping;
+};
+
+// Bounded queue of Capacity values (a power of two) for one consumer and
+// one producer, or several with Multiple_Producers. Producers claim slots
+// by moving the tail (a compare and swap with several producers) and mark
+// each slot ready once written, so a slower producer holds back only the
+// slots it claimed. The consumer takes ready slots in order and moves the
+// head, which frees them. Nothing locks and nothing waits: try_ operations
+// return what they could do, waiting is left to the caller.
+template <typename T, size_t Capacity, bool Multiple_Producers = false>
+class ring_buffer {
+    static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+    public:
+        ring_buffer(): head(0), tail(0), cached_head(0) {
+            for (size_t i = 0; i < Capacity; i++) {
+                slots[i].ready.store(0, std::memory_order_relaxed);
+            }
+        }
+
+        bool try_put(const T& value) {
+            return try_put_n(&value, 1) == 1;
+        }
+
+        // put the first values that fit, at most n, return how many
+        size_t try_put_n(const T* values, size_t n) {
+            size_t t = tail.load(std::memory_order_relaxed);
+            size_t k;
+            for (;;) {
+                k = std::min(n, Capacity - (t - producer_head(t, n)));
+                if (k == 0) {
+                    return 0;
+                }
+                if (!Multiple_Producers) {
+                    tail.store(t + k, std::memory_order_relaxed);
+                    break;
+                }
+                if (tail.compare_exchange_weak(t, t + k, std::memory_order_relaxed)) {
+                    break;
+                }
+            }
+            for (size_t i = 0; i < k; i++) {
+                slot& s = slots[(t + i) & (Capacity - 1)];
+                s.value = values[i];
+                s.ready.store(t + i + 1, std::memory_order_release);
+            }
+            return k;
+        }
+
+        // next value without taking it, nullptr if none is ready, consumer only
+        const T* front() const {
+            const size_t h = head.load(std::memory_order_relaxed);
+            const slot& s = slots[h & (Capacity - 1)];
+            return s.ready.load(std::memory_order_acquire) == h + 1 ? &s.value : nullptr;
+        }
+
+        // take the value front returned, consumer only
+        void pop() {
+            head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        }
+
+        bool try_get(T& value) {
+            return drain(&value, 1) == 1;
+        }
+
+        // take up to max ready values in order, return how many, consumer only
+        size_t drain(T* out, size_t max) {
+            const size_t h = head.load(std::memory_order_relaxed);
+            size_t k = 0;
+            for (; k < max; k++) {
+                const slot& s = slots[(h + k) & (Capacity - 1)];
+                if (s.ready.load(std::memory_order_acquire) != h + k + 1) {
+                    break;
+                }
+                out[k] = s.value;
+            }
+            if (k) {
+                head.store(h + k, std::memory_order_release);
+            }
+            return k;
+        }
+
+        bool empty() const {
+            return front() == nullptr;
+        }
+
+        // values put or being put and not taken yet
+        size_t size() const {
+            return tail.load(std::memory_order_relaxed) - head.load(std::memory_order_relaxed);
+        }
+
+        // a slot is free, it may be taken by another producer meanwhile
+        bool has_space() const {
+            return tail.load(std::memory_order_relaxed) - head.load(std::memory_order_acquire) < Capacity;
+        }
+    private:
+        // head as producers see it, a single one reads it again only when it looks short of n free slots
+        size_t producer_head(size_t t, size_t n) {
+            if (Multiple_Producers) {
+                return head.load(std::memory_order_acquire);
+            }
+            if (Capacity - (t - cached_head) < n) {
+                cached_head = head.load(std::memory_order_acquire);
+            }
+            return cached_head;
+        }
+
+        struct slot {
+            // index + 1 of the value written last, so a slot is ready once per lap
+            std::atomic<size_t> ready;
+            T value;
+        };
+
+        // the indices are written by different threads, keep them on their own cache lines
+        char pad0[64];
+        std::atomic<size_t> head;
+        char pad1[64];
+        std::atomic<size_t> tail;
+        // used by the single producer alone
+        size_t cached_head;
+        char pad2[64];
+        slot slots[Capacity];
+};
+
+#endif